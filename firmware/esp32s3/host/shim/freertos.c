@@ -0,0 +1,289 @@
+/*****************************************************************************
+**  Host build: FreeRTOS and ESP-IDF shims on pthreads
+**
+**  Copyright (C) 2025 Tim Brugman
+**
+**  This program is free software; you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation; either version 2 of the License, or
+**  (at your option) any later version.
+** 
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program; if not, write to the Free Software
+**  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+******************************************************************************/
+#define _GNU_SOURCE
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#include <esp_cpu.h>
+#include <esp_log.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+struct shim_semaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t max;
+};
+
+struct shim_task {
+    pthread_t thread;
+    TaskFunction_t func;
+    void* arg;
+    struct shim_semaphore notify;
+};
+
+static __thread struct shim_task* s_current;
+
+static void shim_sem_init(struct shim_semaphore* sem, uint32_t max);
+
+// Task of the calling thread, threads not started as a task (main) get one
+static struct shim_task* shim_current(void)
+{
+    if (s_current == NULL) {
+        s_current = calloc(1, sizeof(*s_current));
+        s_current->thread = pthread_self();
+        shim_sem_init(&s_current->notify, UINT32_MAX);
+    }
+    return s_current;
+}
+
+static uint64_t shim_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return shim_now_ns() / 1000;
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)shim_now_ns();
+}
+
+static void shim_sem_init(struct shim_semaphore* sem, uint32_t max)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sem->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sem->mutex, NULL);
+    sem->count = 0;
+    sem->max = max;
+}
+
+// Wait until the count is non-zero, then take one (or all with clear)
+static uint32_t shim_sem_take(struct shim_semaphore* sem, TickType_t ticks, bool clear)
+{
+    struct timespec deadline;
+    if (ticks != portMAX_DELAY) {
+        uint64_t ns = shim_now_ns() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ull;
+        deadline.tv_sec = ns / 1000000000ull;
+        deadline.tv_nsec = ns % 1000000000ull;
+    }
+
+    pthread_mutex_lock(&sem->mutex);
+    while (sem->count == 0) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&sem->cond, &sem->mutex);
+        } else if (ticks == 0 || pthread_cond_timedwait(&sem->cond, &sem->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    uint32_t count = sem->count;
+    if (count > 0) {
+        sem->count = clear ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return count;
+}
+
+static bool shim_sem_give(struct shim_semaphore* sem)
+{
+    bool given = false;
+    pthread_mutex_lock(&sem->mutex);
+    if (sem->count < sem->max) {
+        sem->count++;
+        given = true;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return given;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    struct shim_semaphore* sem = malloc(sizeof(*sem));
+    if (sem != NULL) {
+        shim_sem_init(sem, 1);
+    }
+    return sem;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return shim_sem_take(sem, ticks, false) > 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return shim_sem_give(sem) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t* woken)
+{
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+    return xSemaphoreGive(sem);
+}
+
+static void* shim_task_main(void* arg)
+{
+    struct shim_task* task = arg;
+    s_current = task;
+    task->func(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char* name, uint32_t stack, void* arg,
+                                   UBaseType_t prio, TaskHandle_t* handle, BaseType_t core)
+{
+    // pthreads pick their own stack size and run at the normal priority
+    (void)stack;
+    (void)prio;
+
+    struct shim_task* task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return pdFALSE;
+    }
+    task->func = func;
+    task->arg = arg;
+    shim_sem_init(&task->notify, UINT32_MAX);
+    if (handle != NULL) {
+        *handle = task;
+    }
+
+    if (pthread_create(&task->thread, NULL, shim_task_main, task) != 0) {
+        free(task);
+        return pdFALSE;
+    }
+    pthread_detach(task->thread);
+    pthread_setname_np(task->thread, name);
+#ifdef __linux__
+    // Follow the pinning when the host has the cores
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(task->thread, sizeof(cpus), &cpus);
+#endif
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only a task ending itself is used, its handle stays valid
+    if (task == NULL || task == shim_current()) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks * portTICK_PERIOD_MS / 1000,
+        .tv_nsec = (ticks * portTICK_PERIOD_MS % 1000) * 1000000,
+    };
+    nanosleep(&ts, NULL);
+}
+
+void taskYIELD(void)
+{
+    sched_yield();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(shim_now_ns() / (1000000ull * portTICK_PERIOD_MS));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return shim_current();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    return shim_sem_take(&shim_current()->notify, ticks, clear);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    shim_sem_give(&task->notify);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken)
+{
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+    shim_sem_give(&task->notify);
+}
+
+static struct {
+    const char* tag;
+    esp_log_level_t level;
+} shim_log_levels[8];
+static pthread_mutex_t shim_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    pthread_mutex_lock(&shim_log_mutex);
+    for (size_t i = 0; i < sizeof(shim_log_levels) / sizeof(shim_log_levels[0]); i++) {
+        if (shim_log_levels[i].tag == NULL || strcmp(shim_log_levels[i].tag, tag) == 0) {
+            shim_log_levels[i].tag = tag;
+            shim_log_levels[i].level = level;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shim_log_mutex);
+}
+
+esp_log_level_t esp_log_level_get(const char* tag)
+{
+    esp_log_level_t level = ESP_LOG_INFO;
+    pthread_mutex_lock(&shim_log_mutex);
+    for (size_t i = 0; i < sizeof(shim_log_levels) / sizeof(shim_log_levels[0]) && shim_log_levels[i].tag != NULL; i++) {
+        if (strcmp(shim_log_levels[i].tag, tag) == 0) {
+            level = shim_log_levels[i].level;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shim_log_mutex);
+    return level;
+}
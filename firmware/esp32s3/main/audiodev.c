@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <freertos/FreeRTOS.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "emutimer.h"
 
@@ -54,6 +55,7 @@ struct audiodev_t {
     write_output_callback_t write_output_callback;
     int16_t inputBuffer[AUDIO_STEREO_BUFFER_SIZE];
     SemaphoreHandle_t mixer_sem;
+    TaskHandle_t mixer_task;
     emutimer_handle_t timer_mixer;
     bool mixer_reset;
     bool use_stereo;
@@ -101,12 +103,15 @@ audiodev_handle_t audiodev_create(fpga_handle_t fpga_handle, read_input_callback
     // Init IoPort manager
     ioPortInit(io_register_callback, io_unregister_callback, fpga_handle);
 
+    // Create timers, these are kept over resets to stay locked to the audio clock
+    audiodev->timer_mixer = timer_create(AUDIO_SAMPLERATE);
+
     // Init mixer mutex
     audiodev->mixer_sem = xSemaphoreCreateBinary();
     assert(audiodev->mixer_sem != NULL);
 
     // Start the audio task
-    xTaskCreatePinnedToCore(audio_mixer_task, "audio_mixer_task", 4096, audiodev, 6, NULL, 0);
+    xTaskCreatePinnedToCore(audio_mixer_task, "audio_mixer_task", 4096, audiodev, 6, &audiodev->mixer_task, 0);
 
     // Start mixer
     audiodev_start(audiodev);
@@ -115,19 +120,32 @@ audiodev_handle_t audiodev_create(fpga_handle_t fpga_handle, read_input_callback
 }
 
 static uint32_t IRAM_ATTR mixer_get_samples_callback(void *ref)
+{
+    // Mixing is driven by the I2S DMA completion in the mixer task, there is
+    // nothing to catch up on when chip code syncs the mixer
+    return 0;
+}
+
+static uint32_t IRAM_ATTR mixer_get_pending_callback(void *ref)
 {
     audiodev_handle_t audiodev = (audiodev_handle_t)ref;
 
-    // Get the amount of samples to generate
-    uint32_t count = timer_get_duration(audiodev->timer_mixer);
-    if (count >= AUDIO_MONO_BUFFER_SIZE/4) {
-        ESP_LOGI(TAG, "mix %d", count);
-        if (count > AUDIO_MONO_BUFFER_SIZE/2) {
-            count = AUDIO_MONO_BUFFER_SIZE/2;
-        }
-    }
+    // Samples elapsed since the last mix, used to timestamp register writes.
+    // These all end up in the next block.
+    uint32_t count = timer_get_pending(audiodev->timer_mixer);
+    return (count < AUDIO_BLOCK_SIZE) ? count : AUDIO_BLOCK_SIZE - 1;
+}
+
+bool IRAM_ATTR audiodev_clock_event(audiodev_handle_t audiodev, uint32_t frames)
+{
+    BaseType_t woken = pdFALSE;
+
+    timer_clock_event(audiodev->timer_mixer, frames);
+
+    // A DMA buffer has been freed, render the next block
+    vTaskNotifyGiveFromISR(audiodev->mixer_task, &woken);
 
-    return count;
+    return woken == pdTRUE;
 }
 
 static Int32 IRAM_ATTR mixer_write_output_callback(void* arg, Int16* buffer, UInt32 count)
@@ -216,9 +234,6 @@ void audiodev_stop(audiodev_handle_t audiodev)
     xSemaphoreTake(audiodev->mixer_sem, portMAX_DELAY);
     mixerSetEnable(audiodev->mixer, false);
 
-    // Remove timers
-    timer_destroy(audiodev->timer_mixer);
-
     // Disable FPGA IO handling
     fpga_io_stop(audiodev->fpga_handle);
 
@@ -246,14 +261,12 @@ extern const uint8_t moonsound_rom_end[]   asm("_binary_MOONSOUND_rom_end");
 
 void audiodev_start(audiodev_handle_t audiodev)
 {
-    // Reset the I/O ports
+    // Reset the I/O ports, the chips register theirs
     fpga_io_reset(audiodev->fpga_handle);
 
-    // Create timers
-    audiodev->timer_mixer = timer_create(AUDIO_SAMPLERATE);
-
     // Create mixer
-    audiodev->mixer = mixerCreate(mixer_get_samples_callback, audiodev, 128);
+    audiodev->mixer = mixerCreate(mixer_get_samples_callback, audiodev, 2 * AUDIO_BLOCK_SIZE);
+    mixerSetPendingCallback(audiodev->mixer, mixer_get_pending_callback, audiodev);
 
     // By default use MSX-MUSIC separately MSX-AUDIO (mono)
     audiodev->use_stereo = false;
@@ -266,6 +279,9 @@ void audiodev_start(audiodev_handle_t audiodev)
     // Connect I2S input from FPGA to mixer
     mixerRegisterChannel(audiodev->mixer, 0, MIXER_CHANNEL_PSG, MIXER_CHANNEL_SCC, false, fpga_input_sync, audiodev);
 
+    // Send the port registrations of the chips and enable IO
+    fpga_io_commit(audiodev->fpga_handle);
+
     // Basic mixer configuration
     mixerSetWriteCallback(audiodev->mixer, mixer_write_output_callback, audiodev);
     mixerSetMasterVolume(audiodev->mixer, 100);
@@ -301,11 +317,11 @@ void audiodev_start(audiodev_handle_t audiodev)
     mixerEnableChannelType(audiodev->mixer, MIXER_CHANNEL_YMF262, 1);
     mixerEnableChannelType(audiodev->mixer, MIXER_CHANNEL_YMF278, 1);
 
-    // Pre-fill I2S buffer
-    Int16 buffer[128];
+    // Pre-fill the I2S DMA buffers, this sets the output latency
+    Int16 buffer[2 * AUDIO_BLOCK_SIZE];
     int written = 0;
     memset(buffer, 0, sizeof(buffer));
-    for(int i = 0; i < 8; i++) {
+    for(int i = 0; i < AUDIO_BLOCK_COUNT; i++) {
         written += mixer_write_output_callback(audiodev, buffer, sizeof(buffer) / sizeof(Int16));
     }
     ESP_LOGI(TAG, "Pre-filled %d samples", written);
@@ -326,27 +342,40 @@ static void IRAM_ATTR audio_mixer_task(void *args)
 
     // Audio mixing loop
     for(;;) {
+        // Wait for the I2S DMA to free up one or more buffers
+        uint32_t blocks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
         xSemaphoreTake(audiodev->mixer_sem, portMAX_DELAY);
 
         // Handle reset
         if (audiodev->mixer_reset) {
-            // Reset timer and warm-up caches
+            // Events that came in while stopped are stale, restart the timeline
             timer_reset(audiodev->timer_mixer);
-            xSemaphoreGive(audiodev->mixer_sem);
-            vTaskDelay(2);
-            xSemaphoreTake(audiodev->mixer_sem, portMAX_DELAY);
-            mixerSync(audiodev->mixer);
             audiodev->mixer_reset = false;
-            xSemaphoreGive(audiodev->mixer_sem);
-            continue;
+            blocks = 1;
         }
 
-        // Mix audio
-        uint32_t tbefore = xTaskGetTickCount();
-        mixerSync(audiodev->mixer);
-        uint32_t tafter = xTaskGetTickCount();
+        if (blocks > AUDIO_BLOCK_COUNT) {
+            ESP_LOGW(TAG, "Audio underrun, %lu blocks late", blocks - AUDIO_BLOCK_COUNT);
+            blocks = AUDIO_BLOCK_COUNT;
+        }
+
+        // Mix audio, one block per freed DMA buffer
+        int64_t tbefore = esp_timer_get_time();
+        for (uint32_t i = 0; i < blocks; i++) {
+            // Writes from here on are timestamped relative to this block
+            timer_get_duration(audiodev->timer_mixer);
+            mixerRender(audiodev->mixer, AUDIO_BLOCK_SIZE);
+        }
+        int64_t tafter = esp_timer_get_time();
+        UInt32 adpcm_credits = msxaudioGetAdpcmCredits(audiodev->msxaudio);
         xSemaphoreGive(audiodev->mixer_sem);
 
+        // Let the MSX send more ADPCM data for the space that was freed
+        if (adpcm_credits > 0) {
+            fpga_adpcm_credit(audiodev->fpga_handle, adpcm_credits);
+        }
+
         // Automatically switch between mono and stereo mode for MSX-MUSIC+MSX-AUDIO
         bool msx_music_active = audiodev->ym2413 && !ym2413IsMuted(audiodev->ym2413);
         bool msx_audio_active = audiodev->msxaudio && !msxaudioIsMuted(audiodev->msxaudio);
@@ -366,8 +395,8 @@ static void IRAM_ATTR audio_mixer_task(void *args)
             }
         }
 
-        // Calculate and report CPU load
-        uint32_t tdiff = tafter - tbefore;
+        // Calculate and report CPU load (percentage of the block period)
+        uint32_t tdiff = (uint32_t)(tafter - tbefore) * AUDIO_SAMPLERATE / 10000 / (blocks * AUDIO_BLOCK_SIZE);
         if (tdiff != tdiffprev) {
             bool report = true;
             if (tdiff == tdiffprev2) {
@@ -382,12 +411,9 @@ static void IRAM_ATTR audio_mixer_task(void *args)
                     tdiffprev2 = tdiffprev;
                     tdiffprev = tdiff;
                 }
-                printf("Mixer CPU Load: %lu, max = %lu\n", tdiff, loadmax);
+                printf("Mixer CPU Load: %lu%%, max = %lu%%\n", tdiff, loadmax);
             }
         }
-
-        // Yield to other tasks
-        vTaskDelay(1);
     }
     vTaskDelete(NULL);
 }
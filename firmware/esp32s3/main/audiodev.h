@@ -24,6 +24,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "fpga.h"
 
@@ -31,6 +32,12 @@
 extern "C" {
 #endif
 
+// Audio is rendered one I2S DMA buffer (block) at a time, triggered by the DMA
+// completion. AUDIO_BLOCK_COUNT buffers are in flight, which trades output
+// latency against underrun margin.
+#define AUDIO_BLOCK_SIZE    128     // frames per block
+#define AUDIO_BLOCK_COUNT   4       // blocks in flight
+
 struct audiodev_t;
 typedef struct audiodev_t* audiodev_handle_t;
 
@@ -43,6 +50,9 @@ void audiodev_destroy(audiodev_handle_t timer);
 void audiodev_stop(audiodev_handle_t fpga_handle);
 void audiodev_start(audiodev_handle_t fpga_handle);
 
+// Called from the I2S DMA interrupt, returns true when a task switch is required
+bool audiodev_clock_event(audiodev_handle_t audiodev, uint32_t frames);
+
 #ifdef __cplusplus
 }
 #endif
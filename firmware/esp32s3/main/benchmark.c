@@ -0,0 +1,479 @@
+/*****************************************************************************
+**  Audio engine benchmark
+**
+**  Renders the software sound chips with all voices playing and reports the
+**  render cost per block, the load on each mixer core and how well the work
+**  scales over the two cores.
+**
+**  Copyright (C) 2025 Tim Brugman
+**
+**  This program is free software; you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation; either version 2 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program; if not, write to the Free Software
+**  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+******************************************************************************/
+#include "benchmark.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_cpu.h>
+
+#include "audiodev.h"
+
+#include "bluemsx/Board.h"
+#include "bluemsx/IoPort.h"
+#include "bluemsx/AudioMixer.h"
+#include "bluemsx/MsxAudio.h"
+#include "bluemsx/Moonsound.h"
+#include "bluemsx/YM2413.h"
+
+// One second of audio per scenario
+#define BENCH_BLOCKS    (AUDIO_SAMPLERATE / AUDIO_BLOCK_SIZE)
+
+// Memory data reads per read latency measurement
+#define BENCH_READS     2048
+
+// Register writes per block in the write cost measurement
+#define BENCH_WRITES    32
+
+// Busy time per tick of the stand-in for the FPGA task on core 1, its IRQ
+// line polling budget
+#define BENCH_BUSY_US   250
+
+// Chips used by a scenario
+#define BENCH_OPL3      0x01
+#define BENCH_OPL4      0x02
+#define BENCH_Y8950     0x04
+#define BENCH_YM2413    0x08
+#define BENCH_OPL4_16   0x10
+
+extern const uint8_t moonsound_rom_start[] asm("_binary_MOONSOUND_rom_start");
+extern const uint8_t moonsound_rom_end[]   asm("_binary_MOONSOUND_rom_end");
+
+// Without the FPGA there are no port properties to upload
+static void io_register_callback(uint8_t port, IoPortProperties_t prop, void* ref)
+{
+    (void)port;
+    (void)prop;
+    (void)ref;
+}
+
+static void io_unregister_callback(uint8_t port, void* ref)
+{
+    (void)port;
+    (void)ref;
+}
+
+static uint32_t samples_callback(void *ref)
+{
+    (void)ref;
+    // Blocks are rendered explicitly
+    return 0;
+}
+
+static void opl3_write(int bank, uint8_t reg, uint8_t value)
+{
+    ioPortWritePort(bank ? 0xc6 : 0xc4, reg);
+    ioPortWritePort(bank ? 0xc7 : 0xc5, value);
+}
+
+static void opl4_write(uint8_t reg, uint8_t value)
+{
+    ioPortWritePort(0x7e, reg);
+    ioPortWritePort(0x7f, value);
+}
+
+static void y8950_write(uint8_t reg, uint8_t value)
+{
+    ioPortWritePort(0xc0, reg);
+    ioPortWritePort(0xc1, value);
+}
+
+static void ym2413_write(uint8_t reg, uint8_t value)
+{
+    ioPortWritePort(0x7c, reg);
+    ioPortWritePort(0x7d, value);
+}
+
+// Key on all 9 melody channels with different instruments
+static void ym2413_start(void)
+{
+    for (int ch = 0; ch < 9; ch++) {
+        ym2413_write(0x30 + ch, ((ch + 1) << 4) | 0x02); // instrument, volume
+        ym2413_write(0x10 + ch, 0x80 + ch * 8);          // F-number
+        ym2413_write(0x20 + ch, 0x30 | (4 << 1));        // sustain, key on, block 4
+    }
+}
+
+// Key on all 18 two-operator channels
+static void opl3_start(void)
+{
+    opl3_write(1, 0x05, 0x03); // NEW + NEW2, OPL3 and OPL4 mode
+    for (int bank = 0; bank < 2; bank++) {
+        for (int ch = 0; ch < 9; ch++) {
+            int op = (ch % 3) + (ch / 3) * 8;
+            for (int i = 0; i < 2; i++) {
+                opl3_write(bank, 0x20 + op + 3 * i, 0x21);   // sustain, multiple 1
+                opl3_write(bank, 0x40 + op + 3 * i, 0x10);   // total level
+                opl3_write(bank, 0x60 + op + 3 * i, 0xf4);   // attack, decay
+                opl3_write(bank, 0x80 + op + 3 * i, 0x24);   // sustain level, release
+                opl3_write(bank, 0xe0 + op + 3 * i, ch & 3); // waveform
+            }
+            opl3_write(bank, 0xc0 + ch, 0x36);               // left + right, feedback
+            opl3_write(bank, 0xa0 + ch, 0x80 + ch * 8);      // F-number
+            opl3_write(bank, 0xb0 + ch, 0x20 | (4 << 2) | 1); // key on, block 4
+        }
+    }
+}
+
+// Key on all 24 wave table slots using ROM tones
+static void opl4_start(void)
+{
+    opl3_write(1, 0x05, 0x03); // NEW2 enables the wave part
+    opl4_write(0x02, 0x10);    // wave table header in ROM, memory access off
+    for (int slot = 0; slot < 24; slot++) {
+        opl4_write(0x20 + slot, (slot * 16) & 0xfe); // F-number low, wave bit 8 clear
+        opl4_write(0x38 + slot, 0x00);               // octave 0
+        opl4_write(0x50 + slot, 0x00);               // total level
+        opl4_write(0x08 + slot, slot * 10);          // wave number, loads header
+        opl4_write(0x68 + slot, 0x80);               // key on
+    }
+}
+
+static void opl4_write_mem(uint32_t addr, const uint8_t *data, int length)
+{
+    opl4_write(0x03, (addr >> 16) & 0x3f);
+    opl4_write(0x04, (addr >> 8) & 0xff);
+    opl4_write(0x05, addr & 0xff);
+    for (int i = 0; i < length; i++) {
+        opl4_write(0x06, data[i]);
+    }
+}
+
+// Key on all 24 wave table slots with a looping 16-bit tone from sample RAM
+static void opl4_start_16bit(void)
+{
+    static const uint8_t header[12] = {
+        0x80 | 0x20, 0x01, 0x00, // 16 bit, start 0x200100
+        0x00, 0x00,              // loop 0
+        0xfc, 0x00,              // end 1024
+        0x00,                    // LFO, vibrato
+        0xf0,                    // attack, decay
+        0x00,                    // sustain level, decay 2
+        0x0f,                    // rate correction, release
+        0x00,                    // AM
+    };
+    uint8_t saw[256];
+
+    opl3_write(1, 0x05, 0x03); // NEW2 enables the wave part
+    opl4_write(0x02, 0x11);    // wave table header for waves 384+ at 0x200000 (RAM), memory access on
+    opl4_write_mem(0x200000, header, sizeof(header));
+    for (size_t i = 0; i < sizeof(saw); i++) {
+        saw[i] = i;
+    }
+    for (int i = 0; i < 2048; i += sizeof(saw)) {
+        opl4_write_mem(0x200100 + i, saw, sizeof(saw));
+    }
+    for (int slot = 0; slot < 24; slot++) {
+        opl4_write(0x20 + slot, ((slot * 16) & 0xfe) | 1); // F-number low, wave bit 8 set
+        opl4_write(0x38 + slot, 0x00);                     // octave 0
+        opl4_write(0x50 + slot, 0x00);                     // total level
+        opl4_write(0x08 + slot, 0x80);                     // wave 384, loads header
+        opl4_write(0x68 + slot, 0x80);                     // key on
+    }
+}
+
+// Key on all 9 FM channels and loop ADPCM from sample RAM
+static void y8950_start(void)
+{
+    for (int ch = 0; ch < 9; ch++) {
+        int op = (ch % 3) + (ch / 3) * 8;
+        for (int i = 0; i < 2; i++) {
+            y8950_write(0x20 + op + 3 * i, 0x21);
+            y8950_write(0x40 + op + 3 * i, 0x10);
+            y8950_write(0x60 + op + 3 * i, 0xf4);
+            y8950_write(0x80 + op + 3 * i, 0x24);
+        }
+        y8950_write(0xc0 + ch, 0x06);
+        y8950_write(0xa0 + ch, 0x80 + ch * 8);
+        y8950_write(0xb0 + ch, 0x20 | (4 << 2) | 1);
+    }
+    y8950_write(0x08, 0x00);  // RAM
+    y8950_write(0x09, 0x00);  // start address
+    y8950_write(0x0a, 0x00);
+    y8950_write(0x0b, 0xff);  // stop address
+    y8950_write(0x0c, 0xff);
+    y8950_write(0x10, 0x00);  // delta-N, ~16kHz
+    y8950_write(0x11, 0x60);
+    y8950_write(0x12, 0xff);  // volume
+    y8950_write(0x07, 0xb0);  // start, memory data, repeat
+}
+
+// Stand-in for the FPGA task: spins on core 1 at mixer priority for its
+// polling budget every tick
+static volatile bool s_busy;
+static SemaphoreHandle_t s_busy_done;
+
+static void benchmark_busy_task(void* arg)
+{
+    (void)arg;
+    while (s_busy) {
+        int64_t end = esp_timer_get_time() + BENCH_BUSY_US;
+        while (esp_timer_get_time() < end) {
+        }
+        vTaskDelay(1);
+    }
+    xSemaphoreGive(s_busy_done);
+    vTaskDelete(NULL);
+}
+
+static void benchmark_busy_start(void)
+{
+    s_busy = true;
+    s_busy_done = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(benchmark_busy_task, "bench_busy", 2048, NULL, 5, NULL, 1);
+}
+
+static void benchmark_busy_stop(void)
+{
+    s_busy = false;
+    xSemaphoreTake(s_busy_done, portMAX_DELAY);
+    vSemaphoreDelete(s_busy_done);
+}
+
+static void benchmark_scenario(const char *name, int chips, MixerBalanceMode mode)
+{
+    Mixer *mixer = mixerCreate(samples_callback, NULL, 2 * AUDIO_BLOCK_SIZE);
+    mixerSetBalanceMode(mixer, mode);
+    Moonsound *moonsound = NULL;
+    MsxAudioHndl msxaudio = NULL;
+    YM_2413 *ym2413 = NULL;
+
+    if (chips & (BENCH_OPL3 | BENCH_OPL4 | BENCH_OPL4_16)) {
+        moonsound = moonsoundCreate(mixer, (uint8_t*)moonsound_rom_start, ((uint8_t*)moonsound_rom_end - (uint8_t*)moonsound_rom_start), 1024);
+    }
+    if (chips & BENCH_Y8950) {
+        msxaudio = msxaudioCreate(mixer);
+    }
+    if (chips & BENCH_YM2413) {
+        ym2413 = ym2413Create(mixer);
+    }
+    mixerSetMasterVolume(mixer, 100);
+    mixerEnableMaster(mixer, 1);
+
+    // Set up the chips before the mixer runs, a full write queue is then
+    // applied directly instead of waiting for a render pass
+    if (chips & BENCH_OPL3) {
+        opl3_start();
+    }
+    if (chips & BENCH_OPL4) {
+        opl4_start();
+    }
+    if (chips & BENCH_OPL4_16) {
+        opl4_start_16bit();
+    }
+    if (chips & BENCH_Y8950) {
+        y8950_start();
+    }
+    if (chips & BENCH_YM2413) {
+        ym2413_start();
+    }
+    mixerSetEnable(mixer, true);
+
+    // Apply the register writes and warm up the caches
+    mixerRender(mixer, AUDIO_BLOCK_SIZE);
+    mixerResetCoreTime(mixer);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        mixerRender(mixer, AUDIO_BLOCK_SIZE);
+    }
+    uint32_t wall = (uint32_t)(esp_timer_get_time() - start);
+    uint32_t core0 = mixerGetCoreTime(mixer, 0);
+    uint32_t core1 = mixerGetCoreTime(mixer, 1);
+    uint32_t audio = (uint32_t)((uint64_t)BENCH_BLOCKS * AUDIO_BLOCK_SIZE * 1000000 / AUDIO_SAMPLERATE);
+    uint32_t cycles = (uint32_t)((uint64_t)(core0 + core1) * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / (BENCH_BLOCKS * AUDIO_BLOCK_SIZE));
+
+    // Load is relative to real time, scaling is the parallel speedup over one core,
+    // cycles are the CPU cycles per output sample summed over both cores
+    printf("Benchmark %-18s %5" PRIu32 " us/block, load %3" PRIu32 "%%, core0 %3" PRIu32 "%%, core1 %3" PRIu32 "%%, scaling %" PRIu32 ".%02" PRIu32 "x, %5" PRIu32 " cycles/sample\n",
+           name, wall / BENCH_BLOCKS, wall * 100 / audio, core0 * 100 / audio, core1 * 100 / audio,
+           (core0 + core1) / wall, (core0 + core1) * 100 / wall % 100, cycles);
+
+    mixerSetEnable(mixer, false);
+    if (ym2413) {
+        ym2413Destroy(ym2413);
+    }
+    if (msxaudio) {
+        msxaudioDestroy(msxaudio);
+    }
+    if (moonsound) {
+        moonsoundDestroy(moonsound);
+    }
+    mixerDestroy(mixer);
+}
+
+// Cost of applying F-number/block writes, which recompute the phase
+// increments, on the render path: the fastest block with queued writes
+// against the fastest block without, in cycles of the calling core. The
+// minimums keep interrupts and cache misses out of a difference that is small
+// next to the render itself.
+static void benchmark_write_cost(void)
+{
+    Mixer *mixer = mixerCreate(samples_callback, NULL, 2 * AUDIO_BLOCK_SIZE);
+    MsxAudioHndl msxaudio = msxaudioCreate(mixer);
+    mixerSetMasterVolume(mixer, 100);
+    mixerEnableMaster(mixer, 1);
+    y8950_start();
+    mixerSetEnable(mixer, true);
+    mixerRender(mixer, AUDIO_BLOCK_SIZE);
+
+    uint32_t idle = UINT32_MAX;
+    uint32_t busy = UINT32_MAX;
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        uint32_t start = esp_cpu_get_cycle_count();
+        mixerRender(mixer, AUDIO_BLOCK_SIZE);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles < idle) idle = cycles;
+
+        for (int w = 0; w < BENCH_WRITES; w++) {
+            int ch = w % 9;
+            if (w & 1) {
+                y8950_write(0xb0 + ch, 0x20 | (((i + w) & 7) << 2) | (w & 3));  // key on, block
+            } else {
+                y8950_write(0xa0 + ch, (uint8_t)(i * 7 + w));                   // F-number
+            }
+        }
+        start = esp_cpu_get_cycle_count();
+        mixerRender(mixer, AUDIO_BLOCK_SIZE);
+        cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles < busy) busy = cycles;
+    }
+
+    int32_t cost = ((int32_t)busy - (int32_t)idle) / BENCH_WRITES;
+    printf("Write cost Y8950 F-number/block   %5" PRId32 " cycles per write\n", cost);
+
+    mixerSetEnable(mixer, false);
+    msxaudioDestroy(msxaudio);
+    mixerDestroy(mixer);
+}
+
+// Time memory data reads as the MSX does them. Without a pending memory write
+// the read is answered on the I/O side, otherwise the queued writes have to be
+// applied under the mixer lock first (on target that also waits for a render
+// pass in progress). With prefetch the ESP32 follows every read with a peek of
+// the next value, that work is off the MSX path as long as read + peek keep up
+// with the MSX read rate.
+static void benchmark_read(const char *name, Mixer *mixer, uint8_t latch_port, uint8_t reg, bool pending_write)
+{
+    uint32_t total = 0;
+    uint32_t max = 0;
+    uint32_t peek_total = 0;
+
+    for (int i = 0; i < BENCH_READS; i++) {
+        // Drain the write queue now and then, reads queue their side effects
+        if ((i & 127) == 0) {
+            mixerRender(mixer, AUDIO_BLOCK_SIZE);
+        }
+        if (pending_write) {
+            ioPortWritePort(latch_port, reg);
+            ioPortWritePort(latch_port + 1, (uint8_t)i);
+        }
+        ioPortWritePort(latch_port, reg);
+
+        uint32_t start = esp_cpu_get_cycle_count();
+        ioPortReadPort(latch_port + 1);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+        total += cycles;
+        if (cycles > max) {
+            max = cycles;
+        }
+
+        uint8_t next;
+        start = esp_cpu_get_cycle_count();
+        ioPortPeekPort(latch_port + 1, &next);
+        peek_total += esp_cpu_get_cycle_count() - start;
+    }
+
+    printf("Read latency %-20s avg %5" PRIu32 " cycles (%3" PRIu32 " ns), max %5" PRIu32 " cycles, peek avg %5" PRIu32 " cycles\n",
+           name, total / BENCH_READS, total / BENCH_READS * 1000 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, max,
+           peek_total / BENCH_READS);
+}
+
+static void benchmark_read_latency(void)
+{
+    Mixer *mixer = mixerCreate(samples_callback, NULL, 2 * AUDIO_BLOCK_SIZE);
+    Moonsound *moonsound = moonsoundCreate(mixer, (uint8_t*)moonsound_rom_start, ((uint8_t*)moonsound_rom_end - (uint8_t*)moonsound_rom_start), 1024);
+    MsxAudioHndl msxaudio = msxaudioCreate(mixer);
+    mixerSetEnable(mixer, true);
+
+    opl3_write(1, 0x05, 0x03); // NEW2 enables the wave part
+    opl4_write(0x02, 0x11);    // memory access on
+    opl4_write(0x03, 0x20);    // RAM at 0x200000
+    opl4_write(0x04, 0x00);
+    opl4_write(0x05, 0x00);
+    benchmark_read("OPL4 memory", mixer, 0x7e, 0x06, false);
+    benchmark_read("OPL4 memory, write", mixer, 0x7e, 0x06, true);
+
+    y8950_write(0x08, 0x00);  // RAM
+    y8950_write(0x07, 0x60);  // memory write
+    y8950_write(0x09, 0x00);  // start address
+    y8950_write(0x0a, 0x00);
+    benchmark_read("Y8950 memory", mixer, 0xc0, 0x0f, false);
+    benchmark_read("Y8950 memory, write", mixer, 0xc0, 0x0f, true);
+
+    mixerSetEnable(mixer, false);
+    msxaudioDestroy(msxaudio);
+    moonsoundDestroy(moonsound);
+    mixerDestroy(mixer);
+}
+
+void benchmark_run(void)
+{
+    ioPortInit(io_register_callback, io_unregister_callback, NULL);
+
+    benchmark_ymf262_check();
+    benchmark_ymf278_check((uint8_t*)moonsound_rom_start, ((uint8_t*)moonsound_rom_end - (uint8_t*)moonsound_rom_start));
+
+    benchmark_scenario("OPL3", BENCH_OPL3, MIXER_BALANCE_STEALING);
+    benchmark_scenario("OPL4", BENCH_OPL4, MIXER_BALANCE_STEALING);
+    benchmark_scenario("OPL4, 16-bit", BENCH_OPL4_16, MIXER_BALANCE_STEALING);
+    benchmark_scenario("Y8950", BENCH_Y8950, MIXER_BALANCE_STEALING);
+    benchmark_scenario("YM2413", BENCH_YM2413, MIXER_BALANCE_STEALING);
+
+    // Native rate with resampling against rendering directly at the mixer rate
+    boardSetNativeRate(false);
+    benchmark_scenario("OPL3, direct", BENCH_OPL3, MIXER_BALANCE_STEALING);
+    benchmark_scenario("YM2413, direct", BENCH_YM2413, MIXER_BALANCE_STEALING);
+    boardSetNativeRate(true);
+
+    // Channel distribution over the mixer cores
+    benchmark_scenario("All, fixed", BENCH_OPL3 | BENCH_OPL4 | BENCH_Y8950, MIXER_BALANCE_FIXED);
+    benchmark_scenario("All, stealing", BENCH_OPL3 | BENCH_OPL4 | BENCH_Y8950, MIXER_BALANCE_STEALING);
+
+    // Same with core 1 shared with IO handling as in production
+    benchmark_busy_start();
+    benchmark_scenario("All, fixed, IO", BENCH_OPL3 | BENCH_OPL4 | BENCH_Y8950, MIXER_BALANCE_FIXED);
+    benchmark_scenario("All, stealing, IO", BENCH_OPL3 | BENCH_OPL4 | BENCH_Y8950, MIXER_BALANCE_STEALING);
+    benchmark_busy_stop();
+
+    benchmark_write_cost();
+    benchmark_read_latency();
+}
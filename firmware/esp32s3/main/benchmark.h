@@ -0,0 +1,39 @@
+/*****************************************************************************
+**  Audio engine benchmark
+**
+**  Copyright (C) 2025 Tim Brugman
+**
+**  This program is free software; you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation; either version 2 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program; if not, write to the Free Software
+**  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+******************************************************************************/
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void benchmark_run(void);
+
+/* Compare the YMF262 block renderer with the per sample renderer */
+bool benchmark_ymf262_check(void);
+
+/* Compare the YMF278 with a copy of the original emulation */
+bool benchmark_ymf278_check(void *romData, int romSize);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,123 @@
+/*****************************************************************************
+**  YMF262 renderer regression check
+**
+**  Feeds two YMF262 instances the same pseudo random register writes and
+**  compares the per sample renderer (updateBuffer) with the block renderer
+**  (renderBlock). Covers 2-op, 4-op and rhythm mode, key on/off and
+**  envelope changes between blocks of random length.
+**
+**  Copyright (C) 2025 Tim Brugman
+**
+**  This program is free software; you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation; either version 2 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program; if not, write to the Free Software
+**  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+******************************************************************************/
+#include "benchmark.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_timer.h>
+
+#include "bluemsx/OpenMsxYMF262.h"
+
+#define CHECK_ITERATIONS    4000
+#define CHECK_MAX_LENGTH    200
+
+static uint32_t check_seed;
+
+static uint32_t check_rand(void)
+{
+    check_seed = check_seed * 1103515245 + 12345;
+    return check_seed >> 8;
+}
+
+static void check_write(YMF262 *a, YMF262 *b, int reg, uint8_t value)
+{
+    a->writeReg(reg, value);
+    b->writeReg(reg, value);
+}
+
+// Register write biased towards the registers that change the rendering path
+static void check_random_write(YMF262 *a, YMF262 *b)
+{
+    static const int operator_regs[] = { 0x20, 0x40, 0x60, 0x80, 0xe0 };
+    int bank = (check_rand() & 1) << 8;
+    uint8_t value = check_rand() & 0xff;
+    int kind = check_rand() % 10;
+
+    if (kind < 3) {
+        check_write(a, b, bank | (0xb0 + check_rand() % 9), value);        // key on/off, block
+    } else if (kind < 4) {
+        check_write(a, b, bank | (0xa0 + check_rand() % 9), value);        // F-number
+    } else if (kind < 5) {
+        check_write(a, b, 0x104, value & 0x3f);                            // 4-op connections
+    } else if (kind < 6) {
+        check_write(a, b, 0xbd, value);                                    // rhythm, LFO depth
+    } else if (kind < 7) {
+        check_write(a, b, bank | (0xc0 + check_rand() % 9), value);        // pan, feedback
+    } else {
+        int offset = check_rand() % 22;
+        if ((offset & 7) > 5) {
+            offset -= 2;
+        }
+        check_write(a, b, bank | (operator_regs[check_rand() % 5] + offset), value);
+    }
+}
+
+bool benchmark_ymf262_check(void)
+{
+    YMF262 *ref = new YMF262();
+    YMF262 *blk = new YMF262();
+    static int ref_buf[2 * CHECK_MAX_LENGTH];
+    static int blk_buf[2 * CHECK_MAX_LENGTH];
+    uint32_t ref_time = 0;
+    uint32_t blk_time = 0;
+    uint32_t samples = 0;
+    bool ok = true;
+
+    ref->setSampleRate(14318180 / 288, 1);
+    blk->setSampleRate(14318180 / 288, 1);
+    check_seed = 1234;
+    check_write(ref, blk, 0x105, 0x01); // OPL3 mode
+
+    for (int i = 0; i < CHECK_ITERATIONS && ok; i++) {
+        int writes = check_rand() % 6;
+        for (int w = 0; w < writes; w++) {
+            check_random_write(ref, blk);
+        }
+
+        int length = 1 + check_rand() % CHECK_MAX_LENGTH;
+        int64_t start = esp_timer_get_time();
+        int *ref_out = ref->updateBuffer(ref_buf, length);
+        int64_t middle = esp_timer_get_time();
+        int *blk_out = blk->renderBlock(blk_buf, length);
+        blk_time += (uint32_t)(esp_timer_get_time() - middle);
+        ref_time += (uint32_t)(middle - start);
+        samples += length;
+
+        if ((ref_out == NULL) != (blk_out == NULL) ||
+            (ref_out != NULL && memcmp(ref_out, blk_out, 2 * length * sizeof(int)) != 0)) {
+            printf("YMF262 check: mismatch at iteration %d\n", i);
+            ok = false;
+        }
+    }
+
+    printf("YMF262 check: %s, %" PRIu32 " samples, per sample %" PRIu32 " us, block %" PRIu32 " us\n",
+           ok ? "passed" : "FAILED", samples, ref_time, blk_time);
+
+    delete blk;
+    delete ref;
+    return ok;
+}
@@ -0,0 +1,215 @@
+/*****************************************************************************
+**  YMF278 renderer regression check
+**
+**  Feeds the current YMF278 and the reference copy of the original
+**  emulation (benchmark_ymf278_ref.cpp) the same pseudo random register
+**  and sample memory writes and compares the rendered output. Covers ROM
+**  and RAM waves in all sample formats, tiny and looping samples, key
+**  on/off and damp, postponed writes, envelope and LFO changes and sample
+**  RAM writes to playing waves, between blocks of random length. Pseudo
+**  reverb is left off, the original never set up its envelope step.
+**
+**  Copyright (C) 2025 Tim Brugman
+**
+**  This program is free software; you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation; either version 2 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program; if not, write to the Free Software
+**  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+******************************************************************************/
+#include "benchmark.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "bluemsx/OpenMsxYMF278.h"
+#include "benchmark_ymf278_ref.h"
+
+#define CHECK_ITERATIONS    4000
+#define CHECK_MAX_LENGTH    200
+#define CHECK_RAM_KB        1024
+
+// Sample RAM layout, the wave tables at 0x200000 and 0x280000 hold the
+// headers of waves 384-511, random sample data sits in between
+#define CHECK_RAM_START     0x200000
+#define CHECK_DATA_START    0x201000
+#define CHECK_DATA_END      0x280000
+#define CHECK_DATA_FILL     0x282000  // room for the longest sample
+
+typedef ymf278_ref::YMF278 YMF278Ref;
+
+static uint32_t check_seed;
+
+static uint32_t check_rand(void)
+{
+    check_seed = check_seed * 1103515245 + 12345;
+    return check_seed >> 8;
+}
+
+static void check_write(YMF278 *a, YMF278Ref *b, uint8_t reg, uint8_t value)
+{
+    a->writeRegOPL4(reg, value);
+    b->writeRegOPL4(reg, value);
+}
+
+static void check_address(YMF278 *a, YMF278Ref *b, uint32_t address)
+{
+    check_write(a, b, 0x03, (address >> 16) & 0x3f);
+    check_write(a, b, 0x04, (address >> 8) & 0xff);
+    check_write(a, b, 0x05, address & 0xff);
+}
+
+// RAM wave header with a random format, start, loop and end, biased
+// towards short samples and tiny ones that end before the second sample
+static void check_random_header(YMF278 *a, YMF278Ref *b, int table, int wave)
+{
+    int bits = check_rand() % 4;
+    uint32_t start = CHECK_DATA_START + check_rand() % (CHECK_DATA_END - CHECK_DATA_START - 0x20000);
+    if (bits == 2) {
+        start &= ~1;  // 16-bit loads
+    }
+
+    int end;
+    switch (check_rand() % 4) {
+    case 0:
+        end = 1 + check_rand() % 3;
+        break;
+    case 1:
+        end = 1 + check_rand() % 64;
+        break;
+    default:
+        end = 1 + check_rand() % 0x10000;
+        break;
+    }
+    int loop = (check_rand() % 4) ? check_rand() % end : check_rand() % 0x10000;
+    int stop = (end - 1) ^ 0xffff;
+
+    uint8_t header[12] = {
+        (uint8_t)((bits << 6) | ((start >> 16) & 0x3f)), (uint8_t)(start >> 8), (uint8_t)start,
+        (uint8_t)(loop >> 8), (uint8_t)loop, (uint8_t)(stop >> 8), (uint8_t)stop,
+    };
+    for (int i = 7; i < 12; i++) {
+        header[i] = check_rand() & 0xff;
+    }
+
+    check_address(a, b, CHECK_RAM_START + table * 0x80000 + wave * 12);
+    for (int i = 0; i < 12; i++) {
+        check_write(a, b, 0x06, header[i]);
+    }
+}
+
+// Register or memory write biased towards the ones that change the
+// sample stream of a slot, false when a memory read differs
+static bool check_random_write(YMF278 *a, YMF278Ref *b)
+{
+    int slot = check_rand() % 24;
+    uint8_t value = check_rand() & 0xff;
+    int kind = check_rand() % 20;
+
+    if (kind < 3) {
+        check_write(a, b, 0x08 + slot, value);                         // wave number
+    } else if (kind < 6) {
+        check_write(a, b, 0x68 + slot, value);                         // key on/off, damp, LFO reset, pan
+    } else if (kind < 7) {
+        check_write(a, b, 0x20 + slot, value);                         // F-number, wave number bit 8
+    } else if (kind < 8) {
+        check_write(a, b, 0x38 + slot, value & ~0x08);                 // octave, no pseudo reverb
+    } else if (kind < 14) {
+        static const uint8_t slot_regs[] = { 0x50, 0x80, 0x98, 0xb0, 0xc8, 0xe0 };
+        check_write(a, b, slot_regs[check_rand() % 6] + slot, value);  // level, LFO, envelope, AM
+    } else if (kind < 15) {
+        check_write(a, b, 0x02, ((4 + (value & 1)) << 2) | 0x01);      // RAM wave table, memory access
+    } else if (kind < 16) {
+        check_write(a, b, 0xf9, value);                                // PCM mix level
+    } else if (kind < 18) {
+        // sample data, possibly of a playing wave
+        check_address(a, b, CHECK_DATA_START + check_rand() % (CHECK_DATA_END - CHECK_DATA_START));
+        int count = 1 + check_rand() % 8;
+        for (int i = 0; i < count; i++) {
+            check_write(a, b, 0x06, check_rand() & 0xff);
+        }
+    } else if (kind < 19) {
+        check_random_header(a, b, check_rand() % 2, check_rand() % 128);
+    } else {
+        check_address(a, b, check_rand() % CHECK_DATA_FILL);
+        return a->readRegOPL4(0x06) == b->readRegOPL4(0x06);
+    }
+    return true;
+}
+
+bool benchmark_ymf278_check(void *romData, int romSize)
+{
+    YMF278Ref *ref = new YMF278Ref(CHECK_RAM_KB, romData, romSize);
+    YMF278 *cur = new YMF278(CHECK_RAM_KB, romData, romSize);
+    static int ref_buf[2 * CHECK_MAX_LENGTH];
+    static int cur_buf[2 * CHECK_MAX_LENGTH];
+    uint32_t ref_time = 0;
+    uint32_t cur_time = 0;
+    uint32_t samples = 0;
+    bool ok = true;
+
+    // Random writes pile up on slots waiting for a zero crossing, both
+    // emulations then apply the postponed writes early and warn about it
+    esp_log_level_t log_level = esp_log_level_get("YMF278");
+    esp_log_level_set("YMF278", ESP_LOG_ERROR);
+
+    ref->setVolume(32767 * 9 / 10);
+    cur->setVolume(32767 * 9 / 10);
+    check_seed = 5678;
+
+    // Random sample data and wave headers in RAM, RAM waves from table 4
+    check_write(cur, ref, 0x02, (4 << 2) | 0x01);
+    check_address(cur, ref, CHECK_RAM_START);
+    for (uint32_t i = CHECK_RAM_START; i < CHECK_DATA_FILL; i++) {
+        check_write(cur, ref, 0x06, check_rand() & 0xff);
+    }
+    for (int wave = 0; wave < 128; wave++) {
+        check_random_header(cur, ref, 0, wave);
+        check_random_header(cur, ref, 1, wave);
+    }
+
+    for (int i = 0; i < CHECK_ITERATIONS && ok; i++) {
+        int writes = check_rand() % 8;
+        for (int w = 0; w < writes && ok; w++) {
+            if (!check_random_write(cur, ref)) {
+                printf("YMF278 check: memory read mismatch at iteration %d\n", i);
+                ok = false;
+            }
+        }
+
+        int length = 1 + check_rand() % CHECK_MAX_LENGTH;
+        int64_t start = esp_timer_get_time();
+        int *ref_out = ref->updateBuffer(ref_buf, length);
+        int64_t middle = esp_timer_get_time();
+        int *cur_out = cur->updateBuffer(cur_buf, length);
+        cur_time += (uint32_t)(esp_timer_get_time() - middle);
+        ref_time += (uint32_t)(middle - start);
+        samples += length;
+
+        if ((ref_out == NULL) != (cur_out == NULL) ||
+            (ref_out != NULL && memcmp(ref_out, cur_out, 2 * length * sizeof(int)) != 0)) {
+            printf("YMF278 check: mismatch at iteration %d\n", i);
+            ok = false;
+        }
+    }
+
+    printf("YMF278 check: %s, %" PRIu32 " samples, reference %" PRIu32 " us, current %" PRIu32 " us\n",
+           ok ? "passed" : "FAILED", samples, ref_time, cur_time);
+
+    esp_log_level_set("YMF278", log_level);
+    delete cur;
+    delete ref;
+    return ok;
+}
@@ -36,6 +36,7 @@ extern "C" {
 
 static inline UInt32 archGetSystemUpTime(UInt32 frequency)
 {
+  (void)frequency;
   return 0;
 }
 
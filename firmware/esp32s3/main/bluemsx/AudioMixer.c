@@ -34,7 +34,9 @@
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
+#include <esp_heap_caps.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 static const char TAG[] = "AudioMixer";
 
@@ -71,8 +73,9 @@ typedef struct {
 
 typedef struct {
     Int32 handle;
-    MixerUpdateCallback updateCallback[2];
+    MixerUpdateCallback updateCallback;
     void* ref;
+    int   core;
     MixerAudioType type;
     MixerAudioType connectedType;
     // User config
@@ -96,7 +99,9 @@ typedef struct {
     int core;
     SemaphoreHandle_t semStart;
     SemaphoreHandle_t semDone;
+    UInt32  busyTime;
     Int32   genBuffer[AUDIO_STEREO_BUFFER_SIZE];
+    Int32*  mixBuffer;      // one block, fragmentSize values
 } MixerTaskData;
 
 struct Mixer
@@ -109,7 +114,6 @@ struct Mixer
     UInt32 begin;
     UInt32 index;
     UInt32 volIndex;
-    Int32   mixBuffer[AUDIO_STEREO_BUFFER_SIZE];
     Int16   buffer[AUDIO_STEREO_BUFFER_SIZE];
     AudioTypeInfo audioTypeInfo[MIXER_CHANNEL_TYPE_COUNT];
     MixerChannel channels[MAX_CHANNELS];
@@ -127,7 +131,12 @@ struct Mixer
     SemaphoreHandle_t sync_sem;
     MixerTaskData taskData[2];
     volatile UInt32  samplesToMix;
-    SemaphoreHandle_t semMix;
+    MixerBalanceMode balanceMode;
+    volatile Int32  nextChannel;
+    GetSamplesToGenerateCallback pendingCallback;
+    void*  pendingRef;
+    volatile UInt32  sampleTime;
+    UInt32  blockTime;
 };
 
 
@@ -144,7 +153,7 @@ static void mixerRecalculateType(Mixer* mixer, int audioType)
 
     for (i = 0; i < mixer->channelCount; i++) {
         MixerChannel* channel = mixer->channels + i;
-        if (channel->type == audioType) {
+        if ((int)channel->type == audioType) {
             channel->enable         = type->enable;
             channel->volume         = type->volume;
             channel->pan            = type->pan;
@@ -201,7 +210,7 @@ Int32 mixerGetChannelTypeVolume(Mixer* mixer, Int32 type, int leftRight)
     updateVolumes(mixer);
 
     for (i = 0; i < mixer->channelCount; i++) {
-        if (mixer->channels[i].type == type) {
+        if ((Int32)mixer->channels[i].type == type) {
             Int32 channelVol = leftRight ?
                                mixer->channels[i].volIntRight :
                                mixer->channels[i].volIntLeft;
@@ -266,16 +275,19 @@ Mixer* mixerCreate(GetSamplesToGenerateCallback callback, void* ref, int fragmen
     mixer->samplesRef = ref;
     mixer->fragmentSize = fragmentSize;
     mixer->enable = false;
+    // Core 1 also runs the FPGA task at mixer priority, with stealing core 0
+    // renders what core 1 has not started on instead of waiting for it
+    mixer->balanceMode = MIXER_BALANCE_STEALING;
 
     mixer->samplesToMix = 0;
-    mixer->semMix = xSemaphoreCreateBinary();
-    xSemaphoreGive(mixer->semMix);
 
     for (int i = 0; i < 2; i++) {
         mixer->taskData[i].mixer = mixer;
         mixer->taskData[i].core = i;
         mixer->taskData[i].semStart = xSemaphoreCreateBinary(); // is taken by default
         mixer->taskData[i].semDone = xSemaphoreCreateBinary();
+        mixer->taskData[i].mixBuffer = (Int32*)heap_caps_malloc(fragmentSize * sizeof(Int32), MALLOC_CAP_INTERNAL);
+        assert(mixer->taskData[i].mixBuffer != NULL);
     }
 
     return mixer;
@@ -285,10 +297,10 @@ void mixerDestroy(Mixer* mixer)
 {
     mixerSetEnable(mixer, false);
     vSemaphoreDelete(mixer->sync_sem);
-    vSemaphoreDelete(mixer->semMix);
     for (int i = 0; i < 2; i++) {
         vSemaphoreDelete(mixer->taskData[i].semStart);
         vSemaphoreDelete(mixer->taskData[i].semDone);
+        heap_caps_free(mixer->taskData[i].mixBuffer);
     }
     free(mixer);
 }
@@ -299,6 +311,37 @@ void mixerSetWriteCallback(Mixer* mixer, MixerWriteCallback callback, void* ref)
     mixer->writeRef = ref;
 }
 
+void mixerSetPendingCallback(Mixer* mixer, GetSamplesToGenerateCallback callback, void* ref)
+{
+    mixer->pendingCallback = callback;
+    mixer->pendingRef = ref;
+}
+
+UInt32 IRAM_ATTR mixerGetSampleTime(Mixer* mixer)
+{
+    // Samples mixed so far plus the samples that have elapsed since the last sync
+    UInt32 time = mixer->sampleTime;
+    if (mixer->pendingCallback != NULL) {
+        time += mixer->pendingCallback(mixer->pendingRef);
+    }
+    return time;
+}
+
+UInt32 IRAM_ATTR mixerGetBlockTime(Mixer* mixer)
+{
+    return mixer->blockTime;
+}
+
+void mixerLock(Mixer* mixer)
+{
+    xSemaphoreTake(mixer->sync_sem, portMAX_DELAY);
+}
+
+void mixerUnlock(Mixer* mixer)
+{
+    xSemaphoreGive(mixer->sync_sem);
+}
+
 Int32 mixerRegisterChannel(Mixer* mixer, int core, Int32 audioType, Int32 connectedType, bool stereo, MixerUpdateCallback callback, void* ref)
 {
     MixerChannel*  channel = mixer->channels + mixer->channelCount;
@@ -310,8 +353,9 @@ Int32 mixerRegisterChannel(Mixer* mixer, int core, Int32 audioType, Int32 connec
 
     mixer->channelCount++;
 
-    channel->updateCallback[core] = callback;
+    channel->updateCallback = callback;
     channel->ref            = ref;
+    channel->core           = core;
     channel->type           = audioType;
     channel->connectedType  = connectedType? connectedType : MIXER_CHANNEL_TYPE_COUNT;
     channel->stereo         = stereo;
@@ -372,6 +416,63 @@ void mixerReset(Mixer* mixer)
     mixer->index = 0;
 }
 
+void mixerSetBalanceMode(Mixer* mixer, MixerBalanceMode mode)
+{
+    xSemaphoreTake(mixer->sync_sem, portMAX_DELAY);
+    mixer->balanceMode = mode;
+    xSemaphoreGive(mixer->sync_sem);
+}
+
+// Render one channel and add it to the mix buffer of this core
+static void IRAM_ATTR mixerChannel(Mixer* mixer, MixerTaskData* task, MixerChannel* channel, UInt32 count)
+{
+    Int32* gen = task->genBuffer;
+    Int32* mix = task->mixBuffer;
+
+    gen = channel->updateCallback(channel->ref, gen, count);
+    if (gen != NULL) {
+        for(UInt32 sample = 0; sample < count; sample++) {
+            if (channel->connectedType != MIXER_CHANNEL_TYPE_COUNT) {
+                int connectedType = channel->connectedType;
+                int chanLeft;
+                int chanRight;
+
+                int tmp = *gen++;
+                chanLeft = channel->volumeLeft * tmp;
+                chanRight = channel->volumeRight * tmp;
+
+                tmp = *gen++;
+                chanLeft += mixer->channels[connectedType].volumeLeft * tmp;
+                chanRight += mixer->channels[connectedType].volumeRight * tmp;
+
+                channel->volCntLeft  += (chanLeft  > 0 ? chanLeft  : -chanLeft)  / 2048;
+                channel->volCntRight += (chanRight > 0 ? chanRight : -chanRight) / 2048;
+
+                *mix++ += chanLeft;
+                *mix++ += chanRight;
+            }else{
+                int chanLeft;
+                int chanRight;
+
+                if (channel->stereo) {
+                    chanLeft = channel->volumeLeft * *gen++;
+                    chanRight = channel->volumeRight * *gen++;
+                }else{
+                    Int32 tmp = *gen++;
+                    chanLeft = channel->volumeLeft * tmp;
+                    chanRight = channel->volumeRight * tmp;
+                }
+
+                channel->volCntLeft  += (chanLeft  > 0 ? chanLeft  : -chanLeft)  / 2048;
+                channel->volCntRight += (chanRight > 0 ? chanRight : -chanRight) / 2048;
+
+                *mix++ += chanLeft;
+                *mix++ += chanRight;
+            }
+        }
+    }
+}
+
 void IRAM_ATTR MixerTask(void *args)
 {
     MixerTaskData *task = (MixerTaskData*)args;
@@ -393,90 +494,91 @@ void IRAM_ATTR MixerTask(void *args)
             break;
         }
         //ESP_LOGI(TAG, "Mix%d: Processing %d samples", core, count);
-        for (int i = 0; i < mixer->channelCount; i++) {
-            if (mixer->channels[i].updateCallback[core] == NULL) {
-                continue;
-            }
+        int64_t start = esp_timer_get_time();
 
-            Int32* gen = task->genBuffer;
-            Int32* mix = mixer->mixBuffer;
+        // Each core accumulates in its own buffer, mixerSync adds them up
+        memset(task->mixBuffer, 0, 2 * count * sizeof(Int32));
 
-            gen = mixer->channels[i].updateCallback[core](mixer->channels[i].ref, gen, count);
-            if (gen == NULL) {
-                continue;
+        if (mixer->balanceMode == MIXER_BALANCE_STEALING) {
+            // Take the next channel nobody has started on yet
+            for (;;) {
+                int i = __atomic_fetch_add(&mixer->nextChannel, 1, __ATOMIC_RELAXED);
+                if (i >= mixer->channelCount) {
+                    break;
+                }
+                if (mixer->channels[i].updateCallback != NULL) {
+                    mixerChannel(mixer, task, &mixer->channels[i], count);
+                }
             }
-
-            xSemaphoreTake(mixer->semMix, portMAX_DELAY);
-
-            for(int sample = 0; sample < count; sample++) {
-                if (mixer->channels[i].connectedType != MIXER_CHANNEL_TYPE_COUNT) {
-                    int connectedType = mixer->channels[i].connectedType;
-                    int chanLeft;
-                    int chanRight;
-
-                    int tmp = *gen++;
-                    chanLeft = mixer->channels[i].volumeLeft * tmp;
-                    chanRight = mixer->channels[i].volumeRight * tmp;
-
-                    tmp = *gen++;
-                    chanLeft += mixer->channels[connectedType].volumeLeft * tmp;
-                    chanRight += mixer->channels[connectedType].volumeRight * tmp;
-
-                    mixer->channels[i].volCntLeft  += (chanLeft  > 0 ? chanLeft  : -chanLeft)  / 2048;
-                    mixer->channels[i].volCntRight += (chanRight > 0 ? chanRight : -chanRight) / 2048;
-
-                    *mix++ += chanLeft;
-                    *mix++ += chanRight;
-                }else{
-                    int chanLeft;
-                    int chanRight;
-
-                    if (mixer->channels[i].stereo) {
-                        chanLeft = mixer->channels[i].volumeLeft * *gen++;
-                        chanRight = mixer->channels[i].volumeRight * *gen++;
-                    }else{
-                        Int32 tmp = *gen++;
-                        chanLeft = mixer->channels[i].volumeLeft * tmp;
-                        chanRight = mixer->channels[i].volumeRight * tmp;
-                    }
-
-                    mixer->channels[i].volCntLeft  += (chanLeft  > 0 ? chanLeft  : -chanLeft)  / 2048;
-                    mixer->channels[i].volCntRight += (chanRight > 0 ? chanRight : -chanRight) / 2048;
-
-                    *mix++ += chanLeft;
-                    *mix++ += chanRight;
+        }else{
+            for (int i = 0; i < mixer->channelCount; i++) {
+                if (mixer->channels[i].updateCallback == NULL || mixer->channels[i].core != core) {
+                    continue;
                 }
+                mixerChannel(mixer, task, &mixer->channels[i], count);
             }
-
-            xSemaphoreGive(mixer->semMix);
         }
+        task->busyTime += (UInt32)(esp_timer_get_time() - start);
         xSemaphoreGive(task->semDone);
     }
     vTaskDelete(NULL);
 }
 
+static void IRAM_ATTR mixerGenerate(Mixer* mixer, UInt32 count);
+
 void IRAM_ATTR mixerSync(Mixer* mixer)
 {
     xSemaphoreTake(mixer->sync_sem, portMAX_DELAY);
 
     UInt32 count = mixer->samplesCallback(mixer->samplesRef);
-    if (count == 0) {
-        xSemaphoreGive(mixer->sync_sem);
-        return;
+    if (count != 0) {
+        mixerGenerate(mixer, count);
     }
+
+    xSemaphoreGive(mixer->sync_sem);
+}
+
+void IRAM_ATTR mixerRender(Mixer* mixer, UInt32 count)
+{
+    xSemaphoreTake(mixer->sync_sem, portMAX_DELAY);
+    mixerGenerate(mixer, count);
+    xSemaphoreGive(mixer->sync_sem);
+}
+
+static void IRAM_ATTR mixerGenerateBlock(Mixer* mixer, UInt32 count);
+
+// Mix count samples and pass them to the write callback, sync_sem must be held
+static void IRAM_ATTR mixerGenerate(Mixer* mixer, UInt32 count)
+{
     if (count > AUDIO_MONO_BUFFER_SIZE) {
         ESP_LOGW(TAG, "Audio mixer overflow (%d)", count);
-        xSemaphoreGive(mixer->sync_sem);
+        mixer->blockTime = mixer->sampleTime;
+        mixer->sampleTime += count;
         return;
     }
 
+    // The per core mix buffers hold one block, mix longer requests in parts
+    UInt32 blockSize = mixer->fragmentSize / 2;
+    while (count > blockSize) {
+        mixerGenerateBlock(mixer, blockSize);
+        count -= blockSize;
+    }
+    mixerGenerateBlock(mixer, count);
+}
+
+static void IRAM_ATTR mixerGenerateBlock(Mixer* mixer, UInt32 count)
+{
+    // Advance the sample timeline, the channels render [blockTime, sampleTime)
+    mixer->blockTime = mixer->sampleTime;
+    mixer->sampleTime += count;
+
     Int16* buffer = mixer->buffer;
 
     if (!mixer->enable) {
         while (count--) {
             buffer[mixer->index++] = 0;
             buffer[mixer->index++] = 0;
-            if (mixer->index >= mixer->fragmentSize) {
+            if (mixer->index >= (UInt32)mixer->fragmentSize) {
                 if (mixer->writeCallback != NULL) {
                     UInt32 written = mixer->writeCallback(mixer->writeRef, buffer, mixer->fragmentSize);
                     count += mixer->fragmentSize - written;
@@ -485,11 +587,10 @@ void IRAM_ATTR mixerSync(Mixer* mixer)
                 mixer->index = 0;
             }
         }
-        xSemaphoreGive(mixer->sync_sem);
         return;
     }
     
-    memset(mixer->mixBuffer, 0, sizeof(mixer->mixBuffer));
+    mixer->nextChannel = 0;
 
     // Set samples to mix for tasks
     mixer->samplesToMix = count;
@@ -507,10 +608,12 @@ void IRAM_ATTR mixerSync(Mixer* mixer)
     // Set to zero, will generate an error when tasks are used incorrectly
     mixer->samplesToMix = 0;
 
-    Int32* mix = mixer->mixBuffer;
+    // Reduce the per core mix buffers
+    Int32* mix0 = mixer->taskData[0].mixBuffer;
+    Int32* mix1 = mixer->taskData[1].mixBuffer;
     while(count--) {
-        Int32 left = *mix++;
-        Int32 right = *mix++;
+        Int32 left = *mix0++ + *mix1++;
+        Int32 right = *mix0++ + *mix1++;
 
         left  /= 4096;
         right /= 4096;
@@ -526,10 +629,10 @@ void IRAM_ATTR mixerSync(Mixer* mixer)
         buffer[mixer->index++] = (Int16)left;
         buffer[mixer->index++] = (Int16)right;
 
-        if (mixer->index >= mixer->fragmentSize) {
+        if (mixer->index >= (UInt32)mixer->fragmentSize) {
             if (mixer->writeCallback != NULL) {
                 UInt32 written = mixer->writeCallback(mixer->writeRef, &buffer[mixer->begin], mixer->fragmentSize);
-                if (written != mixer->fragmentSize) {
+                if (written != (UInt32)mixer->fragmentSize) {
                     mixer->begin += written;
                     if (mixer->index + mixer->fragmentSize >= AUDIO_STEREO_BUFFER_SIZE) {
                         // prevent overflow, need to copy
@@ -595,7 +698,23 @@ void IRAM_ATTR mixerSync(Mixer* mixer)
         }
         mixer->volIndex = 0;
     }
-    xSemaphoreGive(mixer->sync_sem);
+}
+
+UInt32 mixerGetCoreTime(Mixer* mixer, int core)
+{
+    return mixer->taskData[core].busyTime;
+}
+
+void mixerResetCoreTime(Mixer* mixer)
+{
+    for (int i = 0; i < 2; i++) {
+        mixer->taskData[i].busyTime = 0;
+    }
+}
+
+bool IRAM_ATTR mixerIsEnabled(Mixer* mixer)
+{
+    return mixer->enable;
 }
 
 void mixerSetEnable(Mixer* mixer, bool enable)
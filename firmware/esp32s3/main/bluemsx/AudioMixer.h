@@ -58,6 +58,11 @@ typedef enum {
 
 #define MAX_CHANNELS 16
 
+typedef enum {
+    MIXER_BALANCE_FIXED = 0,    // channels stay on the core they were registered on
+    MIXER_BALANCE_STEALING      // a core takes the next channel nobody has started on (default)
+} MixerBalanceMode;
+
 typedef Int32* (*MixerUpdateCallback)(void*, Int32*, UInt32);
 typedef Int32 (*MixerWriteCallback)(void*, Int16*, UInt32);
 typedef UInt32 (*GetSamplesToGenerateCallback)(void *ref);
@@ -85,12 +90,30 @@ void mixerSetWriteCallback(Mixer* mixer, MixerWriteCallback callback, void*);
 /* Internal interface methods */
 void mixerReset(Mixer* mixer);
 void mixerSync(Mixer* mixer);
+void mixerRender(Mixer* mixer, UInt32 count);
+
+/* Sample timeline used to timestamp register writes */
+void mixerSetPendingCallback(Mixer* mixer, GetSamplesToGenerateCallback callback, void* ref);
+UInt32 mixerGetSampleTime(Mixer* mixer);
+UInt32 mixerGetBlockTime(Mixer* mixer);
+
+/* Exclude rendering while chip state is accessed outside the mixer */
+void mixerLock(Mixer* mixer);
+void mixerUnlock(Mixer* mixer);
 
 Int32 mixerRegisterChannel(Mixer* mixer, int core, Int32 audioType, Int32 connectedType, bool stereo,
                            MixerUpdateCallback callback, void*param);
 void mixerSetEnable(Mixer* mixer, bool enable);
+bool mixerIsEnabled(Mixer* mixer);
 void mixerUnregisterChannel(Mixer* mixer, Int32 handle);
 
+/* Distribution of the channels over the mixer cores */
+void mixerSetBalanceMode(Mixer* mixer, MixerBalanceMode mode);
+
+/* Time (us) spent rendering on each mixer core */
+UInt32 mixerGetCoreTime(Mixer* mixer, int core);
+void mixerResetCoreTime(Mixer* mixer);
+
 #ifdef __cplusplus
 }
 #endif
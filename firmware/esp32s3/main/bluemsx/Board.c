@@ -27,6 +27,17 @@ static uint32_t s_pending_irq;
 static void* irq_callback_ref;
 static void (*irq_set_callback)(void* ref);
 static void (*irq_clear_callback)(void* ref);
+static bool s_native_rate = true;
+
+void boardSetNativeRate(bool enable)
+{
+    s_native_rate = enable;
+}
+
+bool boardGetNativeRate(void)
+{
+    return s_native_rate;
+}
 
 void boardSetIrqCallbacks(void (*set_callback)(void* ref), void (*clear_callback)(void* ref), void* ref)
 {
@@ -38,6 +38,11 @@
 extern "C" {
 #endif
 
+// Render the FM chips at their native rate and resample to the mixer rate,
+// takes effect for chips created afterwards
+void boardSetNativeRate(bool enable);
+bool boardGetNativeRate(void);
+
 void boardSetIrqCallbacks(void (*set_callback)(void* ref), void (*clear_callback)(void* ref), void* ref);
 
 void boardSetInt(UInt32 irq);
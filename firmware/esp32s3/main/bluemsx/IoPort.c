@@ -32,6 +32,7 @@
 
 typedef struct IoPortInfo {
     IoPortRead  read;
+    IoPortPeek  peek;
     IoPortWrite write;
     void*       ref;
 } IoPortInfo;
@@ -60,12 +61,20 @@ void* ioPortGetRef(int port)
 }
 
 void ioPortRegister(int port, IoPortRead read, IoPortWrite write, void* ref)
+{
+    ioPortRegisterPrefetch(port, read, NULL, write, ref);
+}
+
+// The peek callback returns the value the next read will return, without
+// side effects, or false when that is not known for the selected register
+void ioPortRegisterPrefetch(int port, IoPortRead read, IoPortPeek peek, IoPortWrite write, void* ref)
 {
     if (ioTable[port].read  == NULL && 
         ioTable[port].write == NULL && 
         ioTable[port].ref   == NULL)
     {
         ioTable[port].read  = read;
+        ioTable[port].peek  = peek;
         ioTable[port].write = write;
         ioTable[port].ref   = ref;
 
@@ -73,6 +82,9 @@ void ioPortRegister(int port, IoPortRead read, IoPortWrite write, void* ref)
         if (read != NULL) {
             prop |= IoPropRead;
         }
+        if (peek != NULL) {
+            prop |= IoPropPrefetch;
+        }
         if (write != NULL) {
             prop |= IoPropWrite;
         }
@@ -84,6 +96,7 @@ void ioPortUnregister(int port)
 {
     ioUnregCb(port, ioRegRef);
     ioTable[port].read  = NULL;
+    ioTable[port].peek  = NULL;
     ioTable[port].write = NULL;
     ioTable[port].ref   = NULL;
 }
@@ -99,6 +112,17 @@ UInt8 ioPortReadPort(UInt16 port)
     return ioTable[port].read(ioTable[port].ref, port);
 }
 
+bool ioPortPeekPort(UInt16 port, UInt8* value)
+{
+    port &= 0xff;
+
+    if (ioTable[port].peek == NULL) {
+        return false;
+    }
+
+    return ioTable[port].peek(ioTable[port].ref, port, value);
+}
+
 void  ioPortWritePort(UInt16 port, UInt8 value)
 {
     port &= 0xff;
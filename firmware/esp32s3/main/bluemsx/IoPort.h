@@ -36,6 +36,7 @@ extern "C" {
 typedef uint8_t IoPortProperties_t;
 static const uint8_t IoPropRead  = 0x01;
 static const uint8_t IoPropWrite = 0x02;
+static const uint8_t IoPropPrefetch = 0x04; // next read value can be peeked
 
 typedef void (*IoPortRegister)(uint8_t port, IoPortProperties_t prop, void* ref);
 typedef void (*IoPortUnregister)(uint8_t port, void* ref);
@@ -44,13 +45,16 @@ void ioPortInit(IoPortRegister regCb, IoPortUnregister unregCb, void *ref);
 
 typedef UInt8 (*IoPortRead)(void*, UInt16);
 typedef void  (*IoPortWrite)(void*, UInt16, UInt8);
+typedef bool  (*IoPortPeek)(void*, UInt16, UInt8*);
 
 void* ioPortGetRef(int port);
 void ioPortRegister(int port, IoPortRead read, IoPortWrite write, void* ref);
+void ioPortRegisterPrefetch(int port, IoPortRead read, IoPortPeek peek, IoPortWrite write, void* ref);
 void ioPortUnregister(int port);
 
 void  ioPortReset();
 UInt8 ioPortReadPort(UInt16 port);
+bool  ioPortPeekPort(UInt16 port, UInt8* value);
 void  ioPortWritePort(UInt16 port, UInt8 value);
 
 #ifdef __cplusplus
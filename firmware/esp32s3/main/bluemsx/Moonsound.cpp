@@ -32,13 +32,16 @@
 
 #include "Board.h"
 #include "IoPort.h"
+#include "WriteQueue.h"
+#include "Resampler.h"
 #include "OpenMsxYMF262.h"
 #include "OpenMsxYMF278.h"
 
 #define FREQUENCY        3579545
+#define YMF262_CLOCK     14318180
  
 struct Moonsound {
-    Moonsound() : opl3latch(0), opl4latch(0) {
+    Moonsound() : opl3latch(0), opl4latch(0), opl4memadr(0), opl4memWritePos(0) {
     }
     ~Moonsound() {
     }
@@ -50,6 +53,15 @@ struct Moonsound {
     YMF262* ymf262;
     int opl3latch;
     UInt8 opl4latch;
+
+    // Copy of the OPL4 memory address kept by the I/O side, memory data reads
+    // are answered from it once the last memory write has been applied
+    UInt32 opl4memadr;
+    UInt32 opl4memWritePos;
+
+    WriteQueue opl3queue;
+    WriteQueue opl4queue;
+    Resampler* opl3resampler;
 };
 
 extern "C" {
@@ -64,7 +76,12 @@ void moonsoundDestroy(Moonsound* moonsound)
     ioPortUnregister(0xc7);
 
     mixerUnregisterChannel(moonsound->mixer, moonsound->handle);
+    writeQueueDestroy(&moonsound->opl3queue);
+    writeQueueDestroy(&moonsound->opl4queue);
 
+    if (moonsound->opl3resampler) {
+        resamplerDestroy(moonsound->opl3resampler);
+    }
     delete moonsound->ymf262;
     delete moonsound->ymf278;
     delete moonsound;
@@ -74,30 +91,114 @@ void moonsoundReset(Moonsound* moonsound)
 {
     moonsound->ymf262->reset();
     moonsound->ymf278->reset();
+    moonsound->opl4memadr = 0;
+}
+
+static Int32* moonsoundRenderYMF262(void* ref, Int32 *buffer, UInt32 count)
+{
+    Moonsound* moonsound = (Moonsound*)ref;
+    return (Int32*)moonsound->ymf262->renderBlock((int*)buffer, count);
+}
+
+static Int32* moonsoundRenderYMF278(void* ref, Int32 *buffer, UInt32 count)
+{
+    Moonsound* moonsound = (Moonsound*)ref;
+    return (Int32*)moonsound->ymf278->updateBuffer((int*)buffer, count);
+}
+
+// The YMF262 generates at its native rate of YMF262_CLOCK / 288
+static Int32* moonsoundResampleYMF262(void* ref, Int32 *buffer, UInt32 count)
+{
+    Moonsound* moonsound = (Moonsound*)ref;
+    return resamplerRender(moonsound->opl3resampler, buffer, count);
+}
+
+static void moonsoundApplyYMF262(void* ref, UInt16 reg, UInt8 value)
+{
+    Moonsound* moonsound = (Moonsound*)ref;
+    moonsound->ymf262->writeReg(reg, value);
+}
+
+static void moonsoundApplyYMF278(void* ref, UInt16 reg, UInt8 value)
+{
+    Moonsound* moonsound = (Moonsound*)ref;
+    if (reg & WRITE_QUEUE_READ) {
+        moonsound->ymf278->readRegOPL4((UInt8)reg);
+    } else {
+        moonsound->ymf278->writeRegOPL4((UInt8)reg, value);
+    }
 }
 
 static Int32* moonsoundSyncYMF262(void* ref, Int32 *buffer, UInt32 count) 
 {
     Moonsound* moonsound = (Moonsound*)ref;
-    return (Int32*)moonsound->ymf262->updateBuffer((int*)buffer, count);
+    return writeQueueRender(&moonsound->opl3queue, moonsound->opl3resampler ? moonsoundResampleYMF262 : moonsoundRenderYMF262, buffer, count);
 }
 
 static Int32* moonsoundSyncYMF278(void* ref, Int32 *buffer, UInt32 count) 
 {
     Moonsound* moonsound = (Moonsound*)ref;
-    return (Int32*)moonsound->ymf278->updateBuffer((int*)buffer, count);
+    return writeQueueRender(&moonsound->opl4queue, moonsoundRenderYMF278, buffer, count);
+}
+
+// Rendering is clocked by the audio output, so reads only need the queued
+// writes applied and never have to sync the mixer
+UInt8 moonsoundReadYMF278(Moonsound* moonsound, UInt16 /*ioPort*/)
+{
+    UInt8 result;
+
+    if (moonsound->opl4latch != 6) {
+        // Everything but memory data is answered by the FPGA, the value
+        // does not depend on the queued writes
+        return moonsound->ymf278->readRegOPL4(moonsound->opl4latch);
+    }
+
+    if (!writeQueueIsApplied(&moonsound->opl4queue, moonsound->opl4memWritePos)) {
+        // Apply the writes up to the last memory write only, the later ones
+        // keep their sample position
+        mixerLock(moonsound->mixer);
+        writeQueueFlushTo(&moonsound->opl4queue, moonsound->opl4memWritePos);
+        mixerUnlock(moonsound->mixer);
+    }
+    // Memory is up to date, read it without waiting for the mixer and
+    // let the chip advance its address in order with the other writes
+    result = moonsound->ymf278->peekMem(moonsound->opl4memadr);
+    writeQueueWrite(&moonsound->opl4queue, WRITE_QUEUE_READ | 6, 0);
+    moonsound->opl4memadr = (moonsound->opl4memadr + 1) & 0xFFFFFF;
+    return result;
 }
 
-UInt8 moonsoundReadYMF278(Moonsound* moonsound, UInt16 ioPort)
+// Value the next read returns, without side effects. Only memory data is
+// known ahead, the FPGA keeps it prefetched for sequential reads.
+bool moonsoundPeekYMF278(Moonsound* moonsound, UInt16 /*ioPort*/, UInt8* value)
 {
-    mixerSync(moonsound->mixer);
-    return moonsound->ymf278->readRegOPL4(moonsound->opl4latch);
+    if (moonsound->opl4latch != 6) {
+        return false;
+    }
+    if (!writeQueueIsApplied(&moonsound->opl4queue, moonsound->opl4memWritePos)) {
+        mixerLock(moonsound->mixer);
+        writeQueueFlushTo(&moonsound->opl4queue, moonsound->opl4memWritePos);
+        mixerUnlock(moonsound->mixer);
+    }
+    *value = moonsound->ymf278->peekMem(moonsound->opl4memadr);
+    return true;
 }
 
-UInt8 moonsoundReadYMF262(Moonsound* moonsound, UInt16 ioPort)
+// A register reads back its last write. Apply the queued writes up to the
+// last one to it, in either bank, or to a later mode change (0x105, which
+// remaps the banks), and leave the rest queued.
+UInt8 moonsoundReadYMF262(Moonsound* moonsound, UInt16 /*ioPort*/)
 {
-    mixerSync(moonsound->mixer);
-    return moonsound->ymf262->readReg(moonsound->opl3latch);
+    UInt32 position = writeQueueLastWrite(&moonsound->opl3queue, moonsound->opl3latch, 0xFF);
+    UInt32 mode = writeQueueLastWrite(&moonsound->opl3queue, 0x105, 0x1FF);
+    if ((Int32)(mode - position) > 0) {
+        position = mode;
+    }
+    mixerLock(moonsound->mixer);
+    writeQueueFlushTo(&moonsound->opl3queue, position);
+    UInt8 result = moonsound->ymf262->readReg(moonsound->opl3latch);
+    mixerUnlock(moonsound->mixer);
+    return result;
 }
 
 void moonsoundWriteYMF278(Moonsound* moonsound, UInt16 ioPort, UInt8 value)
@@ -107,8 +208,22 @@ void moonsoundWriteYMF278(Moonsound* moonsound, UInt16 ioPort, UInt8 value)
         moonsound->opl4latch = value;
         break;
     case 1:
-        mixerSync(moonsound->mixer);
-        moonsound->ymf278->writeRegOPL4(moonsound->opl4latch, value);
+        writeQueueWrite(&moonsound->opl4queue, moonsound->opl4latch, value);
+        switch (moonsound->opl4latch) {
+        case 3:
+            moonsound->opl4memadr = (moonsound->opl4memadr & 0x00FFFF) | (value << 16);
+            break;
+        case 4:
+            moonsound->opl4memadr = (moonsound->opl4memadr & 0xFF00FF) | (value << 8);
+            break;
+        case 5:
+            moonsound->opl4memadr = (moonsound->opl4memadr & 0xFFFF00) | value;
+            break;
+        case 6:
+            moonsound->opl4memadr = (moonsound->opl4memadr + 1) & 0xFFFFFF;
+            moonsound->opl4memWritePos = writeQueuePosition(&moonsound->opl4queue);
+            break;
+        }
         break;
     }
 }
@@ -124,8 +239,7 @@ void moonsoundWriteYMF262(Moonsound* moonsound, UInt16 ioPort, UInt8 value)
         break;
     case 1:
     case 3: // write fm register
-        mixerSync(moonsound->mixer);
-        moonsound->ymf262->writeReg(moonsound->opl3latch, value);
+        writeQueueWrite(&moonsound->opl3queue, moonsound->opl3latch, value);
         break;
     }
 }
@@ -136,18 +250,22 @@ Moonsound* moonsoundCreate(Mixer* mixer, void* romData, int romSize, int sramSiz
 
     moonsound->mixer = mixer;
 
+    writeQueueInit(&moonsound->opl3queue, mixer, moonsoundApplyYMF262, moonsound);
+    writeQueueInit(&moonsound->opl4queue, mixer, moonsoundApplyYMF278, moonsound);
+    moonsound->opl3resampler = boardGetNativeRate() ? resamplerCreate(YMF262_CLOCK, 288, AUDIO_SAMPLERATE, moonsoundRenderYMF262, moonsound) : NULL;
+
     moonsound->handle = mixerRegisterChannel(mixer, 0, MIXER_CHANNEL_YMF262, 0, true, moonsoundSyncYMF262, moonsound);
     moonsound->handle = mixerRegisterChannel(mixer, 1, MIXER_CHANNEL_YMF278, 0, true, moonsoundSyncYMF278, moonsound);
 
     moonsound->ymf262 = new YMF262();
-    moonsound->ymf262->setSampleRate(AUDIO_SAMPLERATE, 1);
+    moonsound->ymf262->setSampleRate(moonsound->opl3resampler ? YMF262_CLOCK / 288 : AUDIO_SAMPLERATE, 1);
 	moonsound->ymf262->setVolume(32767 * 9 / 10);
 
     moonsound->ymf278 = new YMF278(sramSize, romData, romSize);
     moonsound->ymf278->setVolume(32767 * 9 / 10);
 
     ioPortRegister(0x7e, NULL                           , (IoPortWrite)moonsoundWriteYMF278, moonsound);
-    ioPortRegister(0x7f, (IoPortRead)moonsoundReadYMF278, (IoPortWrite)moonsoundWriteYMF278, moonsound);
+    ioPortRegisterPrefetch(0x7f, (IoPortRead)moonsoundReadYMF278, (IoPortPeek)moonsoundPeekYMF278, (IoPortWrite)moonsoundWriteYMF278, moonsound);
     ioPortRegister(0xc4, NULL,                            (IoPortWrite)moonsoundWriteYMF262, moonsound);
     ioPortRegister(0xc5, (IoPortRead)moonsoundReadYMF262, (IoPortWrite)moonsoundWriteYMF262, moonsound);
     ioPortRegister(0xc6, NULL,                            (IoPortWrite)moonsoundWriteYMF262, moonsound);
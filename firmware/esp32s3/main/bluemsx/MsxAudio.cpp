@@ -32,8 +32,13 @@
 
 #include "OpenMsxY8950.h"
 #include "IoPort.h"
+#include "WriteQueue.h"
 
 #define FREQUENCY        3579545
+
+// Keep enough ADPCM data queued to cover ~8ms of playback, a few mixer
+// blocks, so the FIFO doesn't run dry while the MSX waits for credits
+#define ADPCM_FIFO_LATENCY (AUDIO_SAMPLERATE / 125)
  
 #define OFFSETOF(s, a) ((int)(&((s*)0)->a))
 
@@ -42,15 +47,68 @@ struct MsxAudio {
     Int32  handle;
     Y8950* y8950;
     UInt8  registerLatch;
+    UInt32 adpcmGranted;
+    WriteQueue queue;
+
+    // Copy of the ADPCM memory pointer kept by the I/O side, memory data reads
+    // are answered from it once the last memory write has been applied
+    UInt8  adpcmReg7;
+    UInt8  adpcmReg8;
+    int    adpcmStart;
+    int    adpcmPntr;
+    UInt32 adpcmWritePos;
 };
 
 
-extern "C" Int32* msxaudioSync(void* ref, Int32 *buffer, UInt32 count) 
+static Int32* msxaudioRender(void* ref, Int32 *buffer, UInt32 count)
 {
     MsxAudio* msxaudio = (MsxAudio*)ref;
     return (Int32*)msxaudio->y8950->updateBuffer((int*)buffer, count);
 }
 
+static void msxaudioApply(void* ref, UInt16 reg, UInt8 value)
+{
+    MsxAudio* msxaudio = (MsxAudio*)ref;
+    if (reg & WRITE_QUEUE_READ) {
+        msxaudio->y8950->readReg((UInt8)reg);
+    } else {
+        msxaudio->y8950->writeReg((UInt8)reg, value);
+    }
+}
+
+// Track the ADPCM memory pointer the same way Y8950Adpcm does
+static void msxaudioTrackWrite(MsxAudio* msxaudio, UInt8 reg, UInt8 value)
+{
+    switch (reg) {
+    case 0x07:
+        msxaudio->adpcmReg7 = value;
+        break;
+    case 0x08:
+        msxaudio->adpcmReg8 = value;
+        break;
+    case 0x09:
+        msxaudio->adpcmStart = (msxaudio->adpcmStart & 0x7F800) | (value << 3);
+        msxaudio->adpcmPntr = 0;
+        break;
+    case 0x0A:
+        msxaudio->adpcmStart = (msxaudio->adpcmStart & 0x007F8) | (value << 11);
+        msxaudio->adpcmPntr = 0;
+        break;
+    case 0x0F:
+        if ((msxaudio->adpcmReg7 & 0xE0) == 0x60) {
+            msxaudio->adpcmPntr += 2;
+            msxaudio->adpcmWritePos = writeQueuePosition(&msxaudio->queue);
+        }
+        break;
+    }
+}
+
+extern "C" Int32* msxaudioSync(void* ref, Int32 *buffer, UInt32 count) 
+{
+    MsxAudio* msxaudio = (MsxAudio*)ref;
+    return writeQueueRender(&msxaudio->queue, msxaudioRender, buffer, count);
+}
+
 
 extern "C" void msxaudioDestroy(MsxAudioHndl rm) {
     MsxAudio* msxaudio = (MsxAudio*)rm;
@@ -59,21 +117,70 @@ extern "C" void msxaudioDestroy(MsxAudioHndl rm) {
     ioPortUnregister(0xc1);
 
     mixerUnregisterChannel(msxaudio->mixer, msxaudio->handle);
+    writeQueueDestroy(&msxaudio->queue);
 
     delete msxaudio->y8950;
     delete msxaudio;
 }
 
 
+// ADPCM memory data at the tracked pointer, sample RAM must be up to date
+static UInt8 msxaudioAdpcmData(MsxAudio* msxaudio)
+{
+    int mask = (msxaudio->adpcmReg8 & 0x02) ? (1 << 17) - 1 : (1 << 19) - 1;
+    int adr = ((msxaudio->adpcmStart + msxaudio->adpcmPntr) & mask) / 2;
+    return (msxaudio->adpcmReg8 & 0x01) ? 0xFF : msxaudio->y8950->peekAdpcmRam(adr);
+}
+
+// Rendering is clocked by the audio output, so reads only need the queued
+// writes applied and never have to sync the mixer. Status and the other
+// registers are answered by the FPGA, only ADPCM memory data gets here.
 extern "C" UInt8 msxaudioRead(MsxAudio* msxaudio, UInt16 /*ioPort*/)
 {
-    mixerSync(msxaudio->mixer);
-    UInt8 result = msxaudio->y8950->readReg(msxaudio->registerLatch);
+    UInt8 result;
+
+    if (msxaudio->registerLatch == 0x0F) {
+        if (!writeQueueIsApplied(&msxaudio->queue, msxaudio->adpcmWritePos)) {
+            // Apply the writes up to the last sample RAM write only, the
+            // later ones keep their sample position
+            mixerLock(msxaudio->mixer);
+            writeQueueFlushTo(&msxaudio->queue, msxaudio->adpcmWritePos);
+            mixerUnlock(msxaudio->mixer);
+        }
+        // Sample RAM is up to date, read it without waiting for the mixer and
+        // let the chip advance its pointer in order with the other writes
+        result = msxaudioAdpcmData(msxaudio);
+        writeQueueWrite(&msxaudio->queue, WRITE_QUEUE_READ | 0x0F, 0);
+    } else {
+        mixerLock(msxaudio->mixer);
+        writeQueueFlush(&msxaudio->queue);
+        result = msxaudio->y8950->readReg(msxaudio->registerLatch);
+        mixerUnlock(msxaudio->mixer);
+    }
+    if (msxaudio->registerLatch == 0x0F) {
+        msxaudio->adpcmPntr += 2;
+    }
     Y8950Log(Y8950LogLevel_Debug, "[%x]->%x\n", msxaudio->registerLatch, result);
 
     return result;
 }
 
+// Value the next read returns, without side effects. Only ADPCM memory data
+// is known ahead, the FPGA keeps it prefetched for sequential reads.
+extern "C" bool msxaudioPeek(MsxAudio* msxaudio, UInt16 /*ioPort*/, UInt8* value)
+{
+    if (msxaudio->registerLatch != 0x0F) {
+        return false;
+    }
+    if (!writeQueueIsApplied(&msxaudio->queue, msxaudio->adpcmWritePos)) {
+        mixerLock(msxaudio->mixer);
+        writeQueueFlushTo(&msxaudio->queue, msxaudio->adpcmWritePos);
+        mixerUnlock(msxaudio->mixer);
+    }
+    *value = msxaudioAdpcmData(msxaudio);
+    return true;
+}
+
 extern "C" void msxaudioWrite(MsxAudio* msxaudio, UInt16 ioPort, UInt8 value) 
 {
     switch (ioPort & 0x01) {
@@ -82,12 +189,28 @@ extern "C" void msxaudioWrite(MsxAudio* msxaudio, UInt16 ioPort, UInt8 value)
         break;
     case 1:
         Y8950Log(Y8950LogLevel_Debug, "[%x]=%x\n", msxaudio->registerLatch, value);
-        mixerSync(msxaudio->mixer);
-        msxaudio->y8950->writeReg(msxaudio->registerLatch, value);
+        writeQueueWrite(&msxaudio->queue, msxaudio->registerLatch, value);
+        msxaudioTrackWrite(msxaudio, msxaudio->registerLatch, value);
         break;
     }
 }
 
+extern "C" UInt32 msxaudioGetAdpcmCredits(MsxAudioHndl audio)
+{
+    MsxAudio* msxaudio = (MsxAudio*)audio;
+
+    // Grant so that granted - consumed never exceeds the window, bytes queued
+    // in the FIFO and credits not yet used by the MSX are both included
+    UInt32 limit = msxaudio->y8950->getAdpcmFifoConsumed() +
+                   msxaudio->y8950->getAdpcmFifoWindow(ADPCM_FIFO_LATENCY);
+    Int32 credits = (Int32)(limit - msxaudio->adpcmGranted);
+    if (credits <= 0) {
+        return 0;
+    }
+    msxaudio->adpcmGranted += credits;
+    return credits;
+}
+
 extern "C" bool msxaudioIsMuted(MsxAudioHndl audio)
 {
     MsxAudio* msxaudio = (MsxAudio*)audio;
@@ -100,6 +223,13 @@ extern "C" MsxAudioHndl msxaudioCreate(Mixer* mixer)
 
     msxaudio->mixer = mixer;
     msxaudio->registerLatch = 0;
+    msxaudio->adpcmGranted = 0;
+    msxaudio->adpcmReg7 = 0;
+    msxaudio->adpcmReg8 = 0;
+    msxaudio->adpcmStart = 0;
+    msxaudio->adpcmPntr = 0;
+    msxaudio->adpcmWritePos = 0;
+    writeQueueInit(&msxaudio->queue, mixer, msxaudioApply, msxaudio);
 
     msxaudio->handle = mixerRegisterChannel(mixer, 0, MIXER_CHANNEL_MSXAUDIO_VOICE, MIXER_CHANNEL_MSXAUDIO_DRUM, false, msxaudioSync, msxaudio);
 
@@ -108,7 +238,7 @@ extern "C" MsxAudioHndl msxaudioCreate(Mixer* mixer)
     msxaudio->y8950->setVolume(32767);
 
     ioPortRegister(0xc0, NULL, (IoPortWrite)msxaudioWrite, msxaudio);
-    ioPortRegister(0xc1, (IoPortRead)msxaudioRead, (IoPortWrite)msxaudioWrite, msxaudio);
+    ioPortRegisterPrefetch(0xc1, (IoPortRead)msxaudioRead, (IoPortPeek)msxaudioPeek, (IoPortWrite)msxaudioWrite, msxaudio);
 
     return (MsxAudioHndl)msxaudio;
 }
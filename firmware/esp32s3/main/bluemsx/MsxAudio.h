@@ -47,6 +47,9 @@ Int32* msxaudioSync(void* ref, Int32 *buffer, UInt32 count);
 
 bool msxaudioIsMuted(MsxAudioHndl audio);
 
+/* ADPCM FIFO space freed since the last call, to be granted to the MSX */
+UInt32 msxaudioGetAdpcmCredits(MsxAudioHndl audio);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,10 +6,22 @@
   * heavily rewritten to fit openMSX structure
   */
 
+#include <cassert>
 #include <cmath>
 #include <esp_heap_caps.h>
+#include <esp_log.h>
 #include "OpenMsxY8950.h"
 
+// The lookup tables are read per sample, keep them in internal RAM.
+// Define Y8950_TABLES_IN_PSRAM to place them in PSRAM instead.
+#ifdef Y8950_TABLES_IN_PSRAM
+#define Y8950_TABLES_CAPS MALLOC_CAP_SPIRAM
+#else
+#define Y8950_TABLES_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+static const char* TAG = "Y8950";
+
 Y8950::tables_t *Y8950::tables;
 Y8950::Slot::slot_tables_t *Y8950::Slot::slot_tables;
 
@@ -53,6 +65,26 @@ unsigned int Y8950::rate_adjust(double x, int rate)
     return (unsigned int)tmp;
 }
 
+void Y8950::RateAdjust::setRate(int rate)
+{
+    // Keeps x * mul in 64 bits for x < 2^30 (DELTA-N << GETA_BITS)
+    assert(rate >= CLK_FREQ / 72 / 4);
+    den = 144 * (uint64_t)rate;
+    mul = ((uint64_t)CLK_FREQ << 32) / (72 * (uint64_t)rate);
+}
+
+// Same as rate_adjust(x, rate): x * CLK_FREQ / 72 / rate rounded. The
+// estimate is at most one short, the remainder corrects it.
+unsigned int Y8950::RateAdjust::operator()(unsigned int x) const
+{
+    uint64_t q = (x * mul + (1ULL << 31)) >> 32;
+    uint64_t num = 2 * (uint64_t)x * CLK_FREQ + den / 2;
+    if (num - q * den >= den) {
+        q++;
+    }
+    return (unsigned int)q;
+}
+
 //**************************************************//
 //                                                  //
 //                  Create tables                   //
@@ -104,13 +136,6 @@ void Y8950::Slot::makeSinTable()
         slot_tables->sintable[PG_WIDTH/2 + i] = 2*DB_MUTE + slot_tables->sintable[i];
 }
 
-void Y8950::makeDphaseNoiseTable(int sampleRate)
-{
-    for (int i=0; i<1024; i++)
-        for (int j=0; j<8; j++)
-            tables->dphaseNoiseTable[i][j] = rate_adjust(i<<j, sampleRate);
-}
-
 // Table for Pitch Modulator 
 void Y8950::makePmTable()
 {
@@ -129,44 +154,34 @@ void Y8950::makeAmTable()
         amtable[1][i] = (int)((double)AM_DEPTH2/2/DB_STEP * (1.0 + sin(2.0*PI*i/PM_PG_WIDTH)));
 }
 
-// Phase increment counter table  
-void Y8950::Slot::makeDphaseTable(int sampleRate)
+// Phase increment counter (fnum : 10bit)
+unsigned int Y8950::Slot::calcDphase(int fnum, int block, int ML) const
 {
-    int mltable[16] = {
+    static const int mltable[16] = {
         1,1*2,2*2,3*2,4*2,5*2,6*2,7*2,8*2,9*2,10*2,10*2,12*2,12*2,15*2,15*2
     };
 
-    for (int fnum=0; fnum<1024; fnum++)
-        for (int block=0; block<8; block++)
-            for (int ML=0; ML<16; ML++)
-                slot_tables->dphaseTable[fnum][block][ML] = 
-                    rate_adjust((((fnum * mltable[ML]) << block) >> (21 - DP_BITS)), sampleRate);
+    return (*prate)(((fnum * mltable[ML]) << block) >> (21 - DP_BITS));
 }
 
-void Y8950::Slot::makeTllTable()
+// KSL + TL (fnum : upper 4 bits)
+int Y8950::Slot::calcTll(int fnum, int block, int TL, int KL)
 {
     #define dB2(x) (int)((x)*2)
-    static int kltable[16] = {
+    static const int kltable[16] = {
         dB2( 0.000),dB2( 9.000),dB2(12.000),dB2(13.875),
         dB2(15.000),dB2(16.125),dB2(16.875),dB2(17.625),
         dB2(18.000),dB2(18.750),dB2(19.125),dB2(19.500),
         dB2(19.875),dB2(20.250),dB2(20.625),dB2(21.000)
     };
 
-    for (int fnum=0; fnum<16; fnum++)
-        for (int block=0; block<8; block++)
-            for (int TL=0; TL<64; TL++)
-                for (int KL=0; KL<4; KL++) {
-                    if (KL==0) {
-                        slot_tables->tllTable[fnum][block][TL][KL] = ALIGN(TL, TL_STEP, EG_STEP);
-                    } else {
-                        int tmp = kltable[fnum] - dB2(3.000) * (7 - block);
-                        if (tmp <= 0)
-                            slot_tables->tllTable[fnum][block][TL][KL] = ALIGN(TL, TL_STEP, EG_STEP);
-                        else 
-                            slot_tables->tllTable[fnum][block][TL][KL] = (int)((tmp>>(3-KL))/EG_STEP) + ALIGN(TL, TL_STEP, EG_STEP);
-                    }
-                }
+    if (KL==0) {
+        return ALIGN(TL, TL_STEP, EG_STEP);
+    }
+    int tmp = kltable[fnum] - dB2(3.000) * (7 - block);
+    if (tmp <= 0)
+        return ALIGN(TL, TL_STEP, EG_STEP);
+    return (int)((tmp>>(3-KL))/EG_STEP) + ALIGN(TL, TL_STEP, EG_STEP);
 }
 
 
@@ -247,9 +262,12 @@ void Y8950::Patch::reset()
 //**********************************************************//
 
 Y8950::Slot::Slot()
+    : prate(nullptr)
 {
     if (slot_tables == nullptr) {
-        slot_tables = (slot_tables_t*)heap_caps_malloc(sizeof(slot_tables_t), MALLOC_CAP_SPIRAM);
+        slot_tables = (slot_tables_t*)heap_caps_malloc(sizeof(slot_tables_t), Y8950_TABLES_CAPS);
+        ESP_LOGI(TAG, "Slot tables %u bytes in %s", (unsigned)sizeof(slot_tables_t),
+                 (Y8950_TABLES_CAPS & MALLOC_CAP_SPIRAM) ? "PSRAM" : "internal RAM");
     }
 }
 
@@ -280,12 +298,13 @@ void Y8950::Slot::reset()
 
 void Y8950::Slot::updatePG()
 {
-    dphase = slot_tables->dphaseTable[fnum][block][patch.ML];
+    // Channels reset their slots before the Y8950 hooks them up, it resets them again
+    dphase = prate ? calcDphase(fnum, block, patch.ML) : 0;
 }
 
 void Y8950::Slot::updateTLL()
 {
-    tll = slot_tables->tllTable[fnum>>6][block][patch.TL][patch.KL];
+    tll = calcTll(fnum>>6, block, patch.TL, patch.KL);
 }
 
 void Y8950::Slot::updateRKS()
@@ -407,16 +426,18 @@ void Y8950::Channel::keyOff()
 
 
 Y8950::Y8950(int sampleRam)
-    : adpcm(*this, sampleRam) /*connector(),*/
+    : sampleRate(CLK_FREQ / 72), adpcm(*this, sampleRam) /*connector(),*/
 {
+    rateAdjust.setRate(sampleRate);
     if (tables == nullptr) {
-        tables = (tables_t*)heap_caps_malloc(sizeof(tables_t), MALLOC_CAP_SPIRAM);
+        tables = (tables_t*)heap_caps_malloc(sizeof(tables_t), Y8950_TABLES_CAPS);
+        ESP_LOGI(TAG, "dB tables %u bytes in %s", (unsigned)sizeof(tables_t),
+                 (Y8950_TABLES_CAPS & MALLOC_CAP_SPIRAM) ? "PSRAM" : "internal RAM");
     }
     makePmTable();
     makeAmTable();
     Slot::makeAdjustTable();
     Slot::makeDB2LinTable();
-    Slot::makeTllTable();
     Slot::makeRksTable();
     Slot::makeSinTable();
 
@@ -428,6 +449,8 @@ Y8950::Y8950(int sampleRam)
         ch[i].mod.plfo_pm = &lfo_pm;
         ch[i].car.plfo_am = &lfo_am;
         ch[i].car.plfo_pm = &lfo_pm;
+        ch[i].mod.prate = &rateAdjust;
+        ch[i].car.prate = &rateAdjust;
     }
 
     reset();
@@ -437,13 +460,12 @@ Y8950::~Y8950()
 {
 }
 
-void Y8950::setSampleRate(int sampleRate, int oversampling)
+void Y8950::setSampleRate(int sampleRate, int /*oversampling*/)
 {
-    adpcm.setSampleRate(sampleRate);
-    Y8950::Slot::makeDphaseTable(sampleRate);
+    this->sampleRate = sampleRate;
+    rateAdjust.setRate(sampleRate);
     Y8950::Slot::makeDphaseARTable(sampleRate);
     Y8950::Slot::makeDphaseDRTable(sampleRate);
-    makeDphaseNoiseTable(sampleRate);
     pm_dphase = rate_adjust(PM_SPEED * PM_DP_WIDTH / (CLK_FREQ/72), sampleRate);
     am_dphase = rate_adjust(AM_SPEED * AM_DP_WIDTH / (CLK_FREQ/72), sampleRate);
 }
@@ -1039,9 +1061,9 @@ void Y8950::writeReg(uint8_t rg, uint8_t data)
             int block = (reg[rg+0x10]>>2)&7;
             ch[c].setFnumber(fNum);
             switch (c) {
-                case 7: noiseA_dphase = tables->dphaseNoiseTable[fNum][block];
+                case 7: noiseA_dphase = rateAdjust(fNum<<block);
                     break;
-                case 8: noiseB_dphase = tables->dphaseNoiseTable[fNum][block];
+                case 8: noiseB_dphase = rateAdjust(fNum<<block);
                     break;
             }
             ch[c].car.updateAll();
@@ -1055,9 +1077,9 @@ void Y8950::writeReg(uint8_t rg, uint8_t data)
             ch[c].setFnumber(fNum);
             ch[c].setBlock(block);
             switch (c) {
-                case 7: noiseA_dphase = tables->dphaseNoiseTable[fNum][block];
+                case 7: noiseA_dphase = rateAdjust(fNum<<block);
                     break;
-                case 8: noiseB_dphase = tables->dphaseNoiseTable[fNum][block];
+                case 8: noiseB_dphase = rateAdjust(fNum<<block);
                     break;
             }
             if (data&0x20)
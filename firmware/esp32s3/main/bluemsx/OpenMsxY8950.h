@@ -108,6 +108,18 @@ static const int AM_DP_WIDTH = 1<<AM_DP_BITS;
 
 class Y8950 : public SoundDevice
 {
+    // rate_adjust of integer values for one sample rate without floating
+    // point, the F-number, noise and DELTA-N writes apply on the render path
+    class RateAdjust {
+    public:
+        void setRate(int rate);
+        unsigned int operator()(unsigned int x) const;
+
+    private:
+        uint64_t mul;   // CLK_FREQ / 72 / rate in 32.32, at most one short
+        uint64_t den;   // 144 * rate
+    };
+
     class Patch {
     public:
         Patch();
@@ -132,13 +144,13 @@ class Y8950 : public SoundDevice
         void reset();
 
         static void makeSinTable();
-        static void makeTllTable();
         static void makeAdjustTable();
         static void makeRksTable();
         static void makeDB2LinTable();
         static void makeDphaseARTable(int sampleRate);
         static void makeDphaseDRTable(int sampleRate);
-        static void makeDphaseTable(int sampleRate);
+        unsigned int calcDphase(int fnum, int block, int ML) const;
+        static int calcTll(int fnum, int block, int TL, int KL);
 
         inline void slotOn();
         inline void slotOff();
@@ -196,6 +208,7 @@ class Y8950 : public SoundDevice
         // refer to Y8950->
         int *plfo_pm;
         int *plfo_am;
+        const RateAdjust *prate;
 
     private:
         static int lin2db(double d);
@@ -204,20 +217,19 @@ class Y8950 : public SoundDevice
 
         #define ALIGN(d,SS,SD) ((int)d*(int)(SS/SD))
 
+        // Only the tables used per sample or on envelope changes are kept,
+        // the phase increment and KSL + TL values are computed on register
+        // writes (calcDphase, calcTll) so the tables fit in internal RAM.
         struct slot_tables_t {
             /** WaveTable for each envelope amp. */
-            int sintable[PG_WIDTH];
+            int16_t sintable[PG_WIDTH];
             /** Phase incr table for Attack. */
             unsigned int dphaseARTable[16][16];
             /** Phase incr table for Decay and Release. */
             unsigned int dphaseDRTable[16][16];
-            /** KSL + TL Table. */
-            int tllTable[16][8][1<<TL_BITS][4];
-            int rksTable[2][8][2];
-            /** Phase incr table for PG. */
-            unsigned int dphaseTable[1024][8][16];
+            uint8_t rksTable[2][8][2];
             /** Liner to Log curve conversion table (for Attack rate). */
-            int AR_ADJUST_TABLE[1<<EG_BITS];
+            int16_t AR_ADJUST_TABLE[1<<EG_BITS];
         };
         static slot_tables_t *slot_tables;
     };
@@ -247,6 +259,12 @@ public:
     
     virtual void setSampleRate(int sampleRate, int Oversampling);
     virtual int* updateBuffer(int *buffer, int length);
+
+    // ADPCM CPU synthesis FIFO flow control
+    unsigned int getAdpcmFifoConsumed() const { return adpcm.getFifoConsumed(); }
+    int getAdpcmFifoWindow(int samples) { return adpcm.getFifoWindow(samples); }
+    // ADPCM sample RAM byte without touching the chip state
+    uint8_t peekAdpcmRam(int adr) { return adpcm.peekRam(adr); }
     
 private:
     // SoundDevice
@@ -255,12 +273,13 @@ private:
     // Definition of envelope mode
     enum { ATTACK,DECAY,SUSHOLD,SUSTINE,RELEASE,FINISH };
     struct tables_t {
-        // Dynamic range
-        unsigned int dphaseNoiseTable[1024][8];
         // dB to Liner table
         short dB2LinTab[(2*DB_MUTE)*2];
     };
     static tables_t *tables;
+    /** Sample rate of the phase increments. */
+    int sampleRate;
+    RateAdjust rateAdjust;
 
     inline static int DB_POS(int x);
     inline static int DB_NEG(int x);
@@ -269,7 +288,6 @@ private:
     inline static int EXPAND_BITS(int x, int s, int d);
     static unsigned int rate_adjust(double x, int rate);
 
-    void makeDphaseNoiseTable(int sampleRate);
     void makePmTable();
     void makeAmTable();
 
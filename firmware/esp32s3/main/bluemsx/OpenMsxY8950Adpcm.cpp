@@ -66,6 +66,7 @@ Y8950Adpcm::Y8950Adpcm(Y8950& y8950_, int sampleRam)
     ramBank = (uint8_t*)heap_caps_malloc(ramSize, MALLOC_CAP_SPIRAM);
     memset(ramBank, 0xFF, ramSize);
     fifo_init(&adpcmFifo, fifoBuffer, sizeof(fifoBuffer));
+    fifoConsumed = 0;
     unschedule();
 }
 
@@ -80,6 +81,7 @@ void Y8950Adpcm::reset()
     startAddr = 0;
     stopAddr = 7;
     memPntr = 0;
+    romBank = false;
     delta = 0;
     step = 0;
     addrMask = (1 << 19) - 1;
@@ -87,11 +89,7 @@ void Y8950Adpcm::reset()
     reg15 = 0;
     writeReg(0x12, 255);  // volume
     restart();
-}
-
-void Y8950Adpcm::setSampleRate(int sr)
-{
-    sampleRate = sr;
+    flushFifo();
 }
 
 bool Y8950Adpcm::muted()
@@ -116,6 +114,20 @@ void Y8950Adpcm::restart()
     volumeWStep = (int)((double)volume * step / MAX_STEP);
 }
 
+void Y8950Adpcm::flushFifo()
+{
+    // Discarded bytes free up space just like played ones
+    fifoConsumed += fifo_count(&adpcmFifo);
+    fifo_clear(&adpcmFifo);
+}
+
+int Y8950Adpcm::getFifoWindow(int samples)
+{
+    // Two nibbles per byte, keep a few bytes in reserve for slow rates
+    int bytes = (int)(((uint64)step * samples / MAX_STEP + 1) / 2) + 4;
+    return (bytes < ADPCM_FIFO_SIZE - 1) ? bytes : ADPCM_FIFO_SIZE - 1;
+}
+
 void Y8950Adpcm::schedule()
 {
 }
@@ -134,10 +146,12 @@ void Y8950Adpcm::writeReg(uint8_t rg, uint8_t data)
             if (reg7 & R07_RESET) {
                 Y8950Log(Y8950LogLevel_Info, "Stop\n");
                 playing = false;
+                flushFifo();
             } else if (data & R07_START) {
                 Y8950Log(Y8950LogLevel_Info, "Start\n");
                 playing = true;
                 restart();
+                flushFifo();
             }
             
             if (playing) {
@@ -188,22 +202,22 @@ void Y8950Adpcm::writeReg(uint8_t rg, uint8_t data)
             }
             if ((reg7 & 0xE0) == 0x80) {
                 // ADPCM synthesis from CPU
-                while (!fifo_push(&adpcmFifo, &data, 1)) {
-                    // TODO: This constantly happens, needs investigation
+                // The MSX waits for BUF_RDY, which the FPGA only sets while
+                // there is space left, so this only drops when it doesn't
+                if (!fifo_push(&adpcmFifo, &data, 1)) {
                     Y8950Log(Y8950LogLevel_Debug, "full\n");
-                    vTaskDelay(1);
                 }
             }
             break;
 
         case 0x10: // DELTA-N (L) 
             delta = (delta & 0xFF00) | data;
-            step = Y8950::rate_adjust(delta<<GETA_BITS, sampleRate);
+            step = y8950.rateAdjust(delta<<GETA_BITS);
             volumeWStep = (int)((double)volume * step / MAX_STEP);
             break;
         case 0x11: // DELTA-N (H) 
             delta = (delta & 0x00FF) | (data << 8);
-            step = Y8950::rate_adjust(delta<<GETA_BITS, sampleRate);
+            step = y8950.rateAdjust(delta<<GETA_BITS);
             volumeWStep = (int)((double)volume * step / MAX_STEP);
             break;
 
@@ -261,6 +275,12 @@ uint8_t Y8950Adpcm::readReg(uint8_t rg)
     return result;
 }
 
+// Sample RAM contents without advancing the memory pointer
+uint8_t Y8950Adpcm::peekRam(int adr)
+{
+    return (adr < ramSize) ? ramBank[adr] : 0xFF;
+}
+
 int Y8950Adpcm::calcSample()
 {
     // This table values are from ymdelta.c by Tatsuyuki Satoh.
@@ -286,6 +306,7 @@ int Y8950Adpcm::calcSample()
                         // do again later
                         return output >> 12;
                     }
+                    fifoConsumed++;
                     val = reg15 >> 4;
                 } else {
                     val = reg15 & 0x0F;
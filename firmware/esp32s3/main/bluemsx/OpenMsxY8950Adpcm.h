@@ -10,6 +10,10 @@
 
 using namespace std;
 
+// CPU synthesis FIFO, delta-N 0xFFFF consumes 24.9kB/s so this holds ~10ms
+// at the highest rate. The MSX is throttled by BUF_RDY credits before it fills.
+#define ADPCM_FIFO_SIZE 256
+
 typedef unsigned long  EmuTime;
 typedef unsigned char  uint8_t;
 typedef unsigned short word;
@@ -23,21 +27,25 @@ public:
     virtual ~Y8950Adpcm();
     
     void reset();
-    void setSampleRate(int sr);
     bool muted();
     void writeReg(uint8_t rg, uint8_t data);
     uint8_t readReg(uint8_t rg);
+    uint8_t peekRam(int adr);
     int calcSample();
+
+    // Bytes taken out of the CPU synthesis FIFO (played or discarded)
+    unsigned int getFifoConsumed() const { return fifoConsumed; }
+    // FIFO bytes needed to keep playing for the given number of samples
+    int getFifoWindow(int samples);
     
 private:
     void schedule();
     void unschedule();
     int CLAP(int min, int x, int max);
     void restart();
+    void flushFifo();
 
     Y8950& y8950;
-
-    int sampleRate;
     
     int ramSize;
     int startAddr;
@@ -62,7 +70,8 @@ private:
     uint8_t reg15;
 
     fifo_t adpcmFifo;
-    uint8_t fifoBuffer[1024];
+    uint8_t fifoBuffer[ADPCM_FIFO_SIZE];
+    unsigned int fifoConsumed;
 };
 
 #endif 
@@ -410,6 +410,82 @@ YMF262Channel::YMF262Channel()
 }
 
 
+// keep track of the channels that have an operator with a running envelope
+//
+// A channel with both envelopes in the off state outputs nothing and its
+// feedback history is already zero (the volume only reaches MAX_ATT_INDEX in
+// small steps, well past ENV_QUIET), so it can be skipped in updateBuffer.
+inline void YMF262::updateActive(int c)
+{
+    YMF262Channel &ch = channels[c];
+    if (ch.slots[SLOT1].state != EG_OFF || ch.slots[SLOT2].state != EG_OFF) {
+        activeChannels |= 1 << c;
+    } else {
+        activeChannels &= ~(1 << c);
+    }
+}
+
+// advance the envelope of an operator by one EG clock,
+// returns true when the envelope reached the off state
+inline bool YMF262Slot::advance_eg(unsigned eg_cnt)
+{
+    switch(state) {
+    case EG_ATT:    // attack phase
+        if (!(eg_cnt & eg_m_ar)) {
+            volume += (~volume * eg_inc[eg_sel_ar + ((eg_cnt >> eg_sh_ar) & 7)]) >> 3;
+            if (volume <= MIN_ATT_INDEX) {
+                volume = MIN_ATT_INDEX;
+                state = EG_DEC;
+            }
+        }
+        break;
+
+    case EG_DEC:    // decay phase
+        if (!(eg_cnt & eg_m_dr)) {
+            volume += eg_inc[eg_sel_dr + ((eg_cnt >> eg_sh_dr) & 7)];
+            if (volume >= sl) {
+                state = EG_SUS;
+            }
+        }
+        break;
+
+    case EG_SUS:    // sustain phase
+        // this is important behaviour:
+        // one can change percusive/non-percussive
+        // modes on the fly and the chip will remain
+        // in sustain phase - verified on real YM3812
+        if (eg_type) {
+            // non-percussive mode
+            // do nothing
+        } else {
+            // percussive mode
+            // during sustain phase chip adds Release Rate (in percussive mode)
+            if (volume != MAX_ATT_INDEX && !(eg_cnt & eg_m_rr)) {
+                volume += eg_inc[eg_sel_rr + ((eg_cnt>>eg_sh_rr) & 7)];
+                if (volume >= MAX_ATT_INDEX) {
+                    volume = MAX_ATT_INDEX;
+                }
+            }
+        }
+        break;
+
+    case EG_REL:    // release phase
+        if (!(eg_cnt & eg_m_rr)) {
+            volume += eg_inc[eg_sel_rr + ((eg_cnt>>eg_sh_rr) & 7)];
+            if (volume >= MAX_ATT_INDEX) {
+                volume = MAX_ATT_INDEX;
+                state = EG_OFF;
+                return true;
+            }
+        }
+    break;
+
+    default:
+        break;
+    }
+    return false;
+}
+
 // advance LFO to next sample
 void IRAM_ATTR YMF262::advance_lfo()
 {
@@ -443,59 +519,8 @@ void IRAM_ATTR YMF262::advance()
             YMF262Channel &ch = channels[i / 2];
             YMF262Slot &op = ch.slots[i & 1];
 
-            // Envelope Generator
-            switch(op.state) {
-            case EG_ATT:    // attack phase
-                if (!(eg_cnt & op.eg_m_ar)) {
-                    op.volume += (~op.volume * eg_inc[op.eg_sel_ar + ((eg_cnt >> op.eg_sh_ar) & 7)]) >> 3;
-                    if (op.volume <= MIN_ATT_INDEX) {
-                        op.volume = MIN_ATT_INDEX;
-                        op.state = EG_DEC;
-                    }
-                }
-                break;
-
-            case EG_DEC:    // decay phase
-                if (!(eg_cnt & op.eg_m_dr)) {
-                    op.volume += eg_inc[op.eg_sel_dr + ((eg_cnt >> op.eg_sh_dr) & 7)];
-                    if (op.volume >= op.sl) {
-                        op.state = EG_SUS;
-                    }
-                }
-                break;
-
-            case EG_SUS:    // sustain phase
-                // this is important behaviour:
-                // one can change percusive/non-percussive
-                // modes on the fly and the chip will remain
-                // in sustain phase - verified on real YM3812
-                if (op.eg_type) {
-                    // non-percussive mode
-                    // do nothing
-                } else {
-                    // percussive mode
-                    // during sustain phase chip adds Release Rate (in percussive mode)
-                    if (op.volume != MAX_ATT_INDEX && !(eg_cnt & op.eg_m_rr)) {
-                        op.volume += eg_inc[op.eg_sel_rr + ((eg_cnt>>op.eg_sh_rr) & 7)];
-                        if (op.volume >= MAX_ATT_INDEX) {
-                            op.volume = MAX_ATT_INDEX;
-                        }
-                    }
-                }
-                break;
-
-            case EG_REL:    // release phase
-                if (!(eg_cnt & op.eg_m_rr)) {
-                    op.volume += eg_inc[op.eg_sel_rr + ((eg_cnt>>op.eg_sh_rr) & 7)];
-                    if (op.volume >= MAX_ATT_INDEX) {
-                        op.volume = MAX_ATT_INDEX;
-                        op.state = EG_OFF;
-                    }
-                }
-            break;
-
-            default:
-                break;
+            if (op.advance_eg(eg_cnt)) {
+                updateActive(i / 2);
             }
         }
     }
@@ -508,6 +533,11 @@ void IRAM_ATTR YMF262::advance()
         op.Cnt += op.Incr;
     }
 
+    advance_noise();
+}
+
+void IRAM_ATTR YMF262::advance_noise()
+{
     // The Noise Generator of the YM3812 is 23-bit shift register.
     // Period is equal to 2^23-2 samples.
     // Register works at sampling frequency of the chip, so output
@@ -592,6 +622,25 @@ void IRAM_ATTR YMF262Channel::chan_calc(uint8_t LFO_AM)
     }
 }
 
+// calculate 2-op channels c and c+3, or the 4-op channel they form
+inline void YMF262::chan_calc_pair(int c, unsigned active)
+{
+    if (channels[c].extended) {
+        // both halves share the phase modulation outputs
+        if (active & ((1 << c) | (8 << c))) {
+            channels[c].chan_calc(LFO_AM);
+            channels[c + 3].chan_calc_ext(LFO_AM);
+        }
+    } else {
+        if (active & (1 << c)) {
+            channels[c].chan_calc(LFO_AM);
+        }
+        if (active & (8 << c)) {
+            channels[c + 3].chan_calc(LFO_AM);
+        }
+    }
+}
+
 // calculate output of a 2nd part of 4-op channel
 void IRAM_ATTR YMF262Channel::chan_calc_ext(uint8_t LFO_AM)
 {
@@ -916,7 +965,7 @@ void YMF262::init_tables(void)
 }
 
 
-void YMF262::setSampleRate(int sampleRate, int Oversampling)
+void YMF262::setSampleRate(int sampleRate, int /*Oversampling*/)
 {
     const int CLCK_FREQ = 14318180;
     double freqbase  = ((double)CLCK_FREQ / (8.0 * 36)) / (double)sampleRate;
@@ -1347,6 +1396,9 @@ void IRAM_ATTR YMF262::writeRegForce(int r, uint8_t v)
                 // TOP-CY off
                 channels[8].slots[SLOT2].FM_KEYOFF(~2);
             }
+            updateActive(6);
+            updateActive(7);
+            updateActive(8);
             return;
         }
 
@@ -1438,6 +1490,10 @@ void IRAM_ATTR YMF262::writeRegForce(int r, uint8_t v)
                     ch.slots[SLOT2].FM_KEYOFF(~1);
                 }
             }
+            updateActive(chan_no);
+            if (chan_no % 9 < 3) {
+                updateActive(chan_no + 3);
+            }
         }
         // update
         if (ch.block_fnum != block_fnum) {
@@ -1729,8 +1785,11 @@ void YMF262::reset()
         for (int s = 0; s < 2; s++) {
             ch.slots[s].state  = EG_OFF;
             ch.slots[s].volume = MAX_ATT_INDEX;
+            ch.slots[s].op1_out[0] = 0;
+            ch.slots[s].op1_out[1] = 0;
         }
     }
+    activeChannels = 0;
     setInternalMute(true);
 }
 
@@ -1783,6 +1842,10 @@ int* IRAM_ATTR YMF262::updateBuffer(int *buffer, int length)
 
     bool rhythmEnabled = (rhythm & 0x20) != 0;
 
+    // the channels write through the static pointer, it may be left pointing
+    // to another instance
+    chanOut = chanout;
+
     int* buf = buffer;
     while (length--) {
         int left = 0;
@@ -1793,72 +1856,37 @@ int* IRAM_ATTR YMF262::updateBuffer(int *buffer, int length)
         // clear channel outputs
         memset(chanout, 0, sizeof(int) * 18);
 
-        // register set #1
-        // extended 4op ch#0 part 1 or 2op ch#0
-        channels[0].chan_calc(LFO_AM);
-        if (channels[0].extended) {
-            // extended 4op ch#0 part 2
-            channels[3].chan_calc_ext(LFO_AM);
-        } else {
-            // standard 2op ch#3
-            channels[3].chan_calc(LFO_AM);
-        }
-
-        // extended 4op ch#1 part 1 or 2op ch#1
-        channels[1].chan_calc(LFO_AM);
-        if (channels[1].extended) {
-            // extended 4op ch#1 part 2
-            channels[4].chan_calc_ext(LFO_AM);
-        } else {
-            // standard 2op ch#4
-            channels[4].chan_calc(LFO_AM);
-        }
+        // channels without a running envelope are silent
+        unsigned active = activeChannels;
 
-        // extended 4op ch#2 part 1 or 2op ch#2
-        channels[2].chan_calc(LFO_AM);
-        if (channels[2].extended) {
-            // extended 4op ch#2 part 2
-            channels[5].chan_calc_ext(LFO_AM);
-        } else {
-            // standard 2op ch#5
-            channels[5].chan_calc(LFO_AM);
-        }
+        // register set #1
+        // 4op ch#0-2 or 2op ch#0-5
+        chan_calc_pair(0, active);
+        chan_calc_pair(1, active);
+        chan_calc_pair(2, active);
 
         if (!rhythmEnabled) {
-            channels[6].chan_calc(LFO_AM);
-            channels[7].chan_calc(LFO_AM);
-            channels[8].chan_calc(LFO_AM);
+            for (int c = 6; c < 9; c++) {
+                if (active & (1 << c)) {
+                    channels[c].chan_calc(LFO_AM);
+                }
+            }
         } else {
             // Rhythm part
             chan_calc_rhythm(noise_rng & 1);
         }
 
         // register set #2
-        channels[9].chan_calc(LFO_AM);
-        if (channels[9].extended) {
-            channels[12].chan_calc_ext(LFO_AM);
-        } else {
-            channels[12].chan_calc(LFO_AM);
-        }
-
-        channels[10].chan_calc(LFO_AM);
-        if (channels[10].extended) {
-            channels[13].chan_calc_ext(LFO_AM);
-        } else {
-            channels[13].chan_calc(LFO_AM);
-        }
-
-        channels[11].chan_calc(LFO_AM);
-        if (channels[11].extended) {
-            channels[14].chan_calc_ext(LFO_AM);
-        } else {
-            channels[14].chan_calc(LFO_AM);
-        }
+        chan_calc_pair(9, active);
+        chan_calc_pair(10, active);
+        chan_calc_pair(11, active);
 
         // channels 15,16,17 are fixed 2-operator channels only
-        channels[15].chan_calc(LFO_AM);
-        channels[16].chan_calc(LFO_AM);
-        channels[17].chan_calc(LFO_AM);
+        for (int c = 15; c < 18; c++) {
+            if (active & (1 << c)) {
+                channels[c].chan_calc(LFO_AM);
+            }
+        }
 
         for (int i = 0; i < 18; i++) {
             left += chanout[i] & pan[4 * i + 0];
@@ -1875,6 +1903,163 @@ int* IRAM_ATTR YMF262::updateBuffer(int *buffer, int length)
     return buffer;
 }
 
+// Block renderer, produces exactly the same output as updateBuffer.
+//
+// The shared generators (LFO, envelope clock and noise) are stepped for the
+// whole block first. Then each channel is rendered for all samples of the
+// block into its own row of blockOut, stepping its operators along. A 4-op
+// pair and the rhythm section are rendered as one unit because they share
+// the phase modulation outputs. Finally the rows are panned and summed.
+int* IRAM_ATTR YMF262::renderBlock(int *buffer, int length)
+{
+    if (isInternalMuted()) {
+        return NULL;
+    }
+
+    bool rhythmEnabled = (rhythm & 0x20) != 0;
+    chanOut = chanout;
+
+    int* buf = buffer;
+    while (length > 0) {
+        int n = length < YMF262_RENDER_BLOCK ? length : YMF262_RENDER_BLOCK;
+        render_chunk(buf, n, rhythmEnabled);
+        buf += 2 * n;
+        length -= n;
+    }
+
+    checkMute();
+    return buffer;
+}
+
+void IRAM_ATTR YMF262::render_chunk(int *buf, int n, bool rhythmEnabled)
+{
+    // shared generators
+    for (int k = 0; k < n; k++) {
+        advance_lfo();
+        blockAm[k] = LFO_AM;
+        blockNoise[k] = noise_rng & 1;
+        blockEgCnt[k] = eg_cnt;
+
+        uint8_t ticks = 0;
+        eg_timer += eg_timer_add;
+        while (eg_timer >= EG_TIMER_OVERFLOW) {
+            eg_timer -= EG_TIMER_OVERFLOW;
+            eg_cnt++;
+            ticks++;
+        }
+        blockEgTicks[k] = ticks;
+
+        advance_noise();
+    }
+
+    unsigned active = activeChannels;
+    unsigned rendered = 0;
+
+    // 2-op channels c and c+3 or the 4-op channel they form
+    static const uint8_t pairs[6] = { 0, 1, 2, 9, 10, 11 };
+    for (int p = 0; p < 6; p++) {
+        int c = pairs[p];
+        unsigned mask = (1 << c) | (8 << c);
+        if (active & mask) {
+            render_unit(c, UNIT_PAIR, n, active);
+            rendered |= mask;
+        } else {
+            skip_channel(c, n);
+            skip_channel(c + 3, n);
+        }
+    }
+
+    if (rhythmEnabled) {
+        render_unit(6, UNIT_RHYTHM, n, active);
+        rendered |= 7 << 6;
+    }
+    for (int c = 6; c < 18; c++) {
+        if ((c >= 9 && c < 15) || (rhythmEnabled && c < 9)) {
+            continue;
+        }
+        if (active & (1 << c)) {
+            render_unit(c, UNIT_SINGLE, n, active);
+            rendered |= 1 << c;
+        } else {
+            skip_channel(c, n);
+        }
+    }
+
+    // pan and mix
+    int left[YMF262_RENDER_BLOCK];
+    int right[YMF262_RENDER_BLOCK];
+    memset(left, 0, sizeof(int) * n);
+    memset(right, 0, sizeof(int) * n);
+    for (int c = 0; c < 18; c++) {
+        if (!(rendered & (1 << c))) {
+            continue;
+        }
+        const int* out = blockOut[c];
+        unsigned panL = pan[4 * c + 0];
+        unsigned panR = pan[4 * c + 1];
+        for (int k = 0; k < n; k++) {
+            left[k] += out[k] & panL;
+            right[k] += out[k] & panR;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        *buf++ = (left[k] << 3);
+        *buf++ = (right[k] << 3);
+    }
+}
+
+// render a channel, 2-op pair/4-op channel or the rhythm section into blockOut
+void IRAM_ATTR YMF262::render_unit(int c, int type, int n, unsigned active)
+{
+    int count = type == UNIT_SINGLE ? 1 : type == UNIT_RHYTHM ? 3 : 2;
+    int step = type == UNIT_PAIR ? 3 : 1;
+
+    for (int k = 0; k < n; k++) {
+        LFO_AM = blockAm[k];
+        for (int i = 0; i < count; i++) {
+            chanout[c + i * step] = 0;
+        }
+
+        switch (type) {
+        case UNIT_SINGLE:
+            channels[c].chan_calc(LFO_AM);
+            break;
+        case UNIT_PAIR:
+            chan_calc_pair(c, active);
+            break;
+        case UNIT_RHYTHM:
+            chan_calc_rhythm(blockNoise[k]);
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int ch = c + i * step;
+            blockOut[ch][k] = chanout[ch];
+
+            for (int s = 0; s < 2; s++) {
+                YMF262Slot &op = channels[ch].slots[s];
+                for (int t = 1; t <= blockEgTicks[k]; t++) {
+                    op.advance_eg(blockEgCnt[k] + t);
+                }
+                op.Cnt += op.Incr;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        updateActive(c + i * step);
+    }
+}
+
+// advance the operators of a channel without envelope over a block
+inline void YMF262::skip_channel(int c, int n)
+{
+    for (int s = 0; s < 2; s++) {
+        YMF262Slot &op = channels[c].slots[s];
+        op.Cnt += op.Incr * n;
+    }
+}
+
 void YMF262::setInternalVolume(short newVolume)
 {
     maxVolume = newVolume;
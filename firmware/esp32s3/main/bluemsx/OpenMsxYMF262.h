@@ -44,6 +44,7 @@ class YMF262Slot
         inline int volume_calc(uint8_t LFO_AM);
         inline void FM_KEYON(uint8_t key_set);
         inline void FM_KEYOFF(uint8_t key_clr);
+        inline bool advance_eg(unsigned eg_cnt);
 
         uint8_t ar; // attack rate: AR<<2
         uint8_t dr; // decay rate:  DR<<2
@@ -126,6 +127,9 @@ static const int R04_MASK_T2      = 0x20;   // Mask Timer2 flag
 static const int R04_MASK_T1      = 0x40;   // Mask Timer1 flag 
 static const int R04_IRQ_RESET    = 0x80;   // IRQ RESET 
 
+// Samples per pass of the block renderer
+static const int YMF262_RENDER_BLOCK = 64;
+
 class YMF262 : public SoundDevice
 {
     public:
@@ -140,6 +144,7 @@ class YMF262 : public SoundDevice
         virtual void setInternalVolume(short volume);
         virtual void setSampleRate(int sampleRate, int Oversampling);
         virtual int* updateBuffer(int *buffer, int length);
+        int* renderBlock(int *buffer, int length);
 
         void callback(uint8_t flag);
 
@@ -151,7 +156,15 @@ class YMF262 : public SoundDevice
         void init_tables(void);
         void advance_lfo();
         void advance();
+        void advance_noise();
         void chan_calc_rhythm(bool noise);
+        inline void chan_calc_pair(int c, unsigned active);
+        inline void updateActive(int c);
+        void render_chunk(int *buf, int n, bool rhythmEnabled);
+        void render_unit(int c, int type, int n, unsigned active);
+        inline void skip_channel(int c, int n);
+
+        enum { UNIT_SINGLE, UNIT_PAIR, UNIT_RHYTHM };
         void set_mul(uint8_t sl, uint8_t v);
         void set_ksl_tl(uint8_t sl, uint8_t v);
         void set_ar_dr(uint8_t sl, uint8_t v);
@@ -192,6 +205,14 @@ class YMF262 : public SoundDevice
         uint8_t nts;            // NTS (note select)
 
         int chanout[20];        // 18 channels + two phase modulation
+        unsigned activeChannels;    // channels with an envelope that is not off
+
+        // block renderer state
+        int blockOut[18][YMF262_RENDER_BLOCK];
+        unsigned blockEgCnt[YMF262_RENDER_BLOCK];
+        uint8_t blockEgTicks[YMF262_RENDER_BLOCK];
+        uint8_t blockAm[YMF262_RENDER_BLOCK];
+        uint8_t blockNoise[YMF262_RENDER_BLOCK];
         short maxVolume;
 };
 
@@ -31,6 +31,13 @@
 #define EG_REV  5   //pseudo reverb
 #define EG_DMP  6   //damp
 
+// Longest wait between slot events, keeps the LFO catch up in range
+#define EG_MAX_WAIT 0x8000
+
+// Slot state that needs refreshing before rendering
+#define SLOT_DIRTY_GAIN 1   // TL, envelope, AM, pan or mix level changed
+#define SLOT_DIRTY_STEP 2   // frequency or vibrato changed
+
 // Pan values, units are -3dB, i.e. 8.
 const static DRAM_ATTR int pan_left[16]  = {
     0, 8, 16, 24, 32, 40, 48, 256, 256,   0,  0,  0,  0,  0,  0, 0
@@ -164,6 +171,8 @@ void YMF278Slot::reset()
     AR = D1R = DL = D2R = RC = RR = 0;
     step = stepptr = 0;
     bits = loopaddr = endaddr = 0;
+    pos = fillpos = 0;
+    ring_rd = ring_wr = 0;
     env_vol = MAX_ATT_INDEX;
     //env_vol_step = env_vol_lim = 0;
 
@@ -194,6 +203,7 @@ void YMF278Slot::reset()
     active = false;
     transition = false;
     transition_index = 0;
+    dirty = SLOT_DIRTY_GAIN | SLOT_DIRTY_STEP;
 }
 
 void IRAM_ATTR YMF278Slot::update_AR()
@@ -239,6 +249,10 @@ void IRAM_ATTR YMF278Slot::update_RR()
 void IRAM_ATTR YMF278Slot::update_C5()
 {
     C5_rate = compute_rate(5);
+    // the pseudo reverb rate has no off value, always set up the step
+    C5_shift = eg_rate_shift[C5_rate];
+    C5_mask = (1 << C5_shift) - 1;
+    C5_select = eg_rate_select[C5_rate];
 }
 
 int IRAM_ATTR YMF278Slot::compute_rate(int val)
@@ -288,156 +302,382 @@ void IRAM_ATTR YMF278Slot::set_lfo(int newlfo)
     lfo_max = lfo_period[(int)lfo];
 }
 
-void IRAM_ATTR YMF278::advance()
+// Catch up the LFO of a slot with the envelope counter. The LFO advances
+// 256 per sample and steps when it passes lfo_max; ticks is the number of
+// steps in the elapsed samples.
+void IRAM_ATTR YMF278::syncLfo(YMF278Slot &op)
 {
-    eg_cnt++;
+    uint16_t elapsed = eg_cnt - op.lfo_time;
+    op.lfo_time = eg_cnt;
+    if (!op.lfo_active || elapsed == 0) {
+        return;
+    }
+    int total = op.lfo_cnt + 256 * elapsed;
+    if (total > op.lfo_max) {
+        int ticks = (total - 1) / op.lfo_max;
+        op.lfo_cnt = total - ticks * op.lfo_max;
+        op.lfo_idx = (op.lfo_idx + ticks) & 1023;
+        op.lfo_step = lfo_lookup[op.lfo_idx];
+        op.dirty = SLOT_DIRTY_GAIN | SLOT_DIRTY_STEP;
+    } else {
+        op.lfo_cnt = total;
+    }
+}
 
-    for (int i = 0; i < 24; i++) {
-        YMF278Slot &op = slots[i];
+// Samples until (eg_cnt & mask) is zero again
+static inline unsigned maskWait(uint16_t eg_cnt, unsigned mask)
+{
+    if (mask & (mask + 1)) {
+        // not a power of 2 minus 1, check every sample
+        return 1;
+    }
+    return (~eg_cnt & mask) + 1;
+}
 
-        if (op.lfo_active) {
-            op.lfo_cnt += 256;
-            if (op.lfo_cnt > op.lfo_max) {
-                op.lfo_cnt -= op.lfo_max;
-                op.lfo_idx = (op.lfo_idx + 1) & 1023;
-                op.lfo_step = lfo_lookup[op.lfo_idx];
+// Schedule the next sample at which the envelope of a slot may step or its
+// LFO ticks while it is playing. Slots that are off and fully attenuated
+// only have their LFO caught up at least every EG_MAX_WAIT samples.
+void IRAM_ATTR YMF278::scheduleSlot(YMF278Slot &op)
+{
+    unsigned wait = EG_MAX_WAIT;
+
+    bool settled = !op.active && op.env_vol == MAX_ATT_INDEX &&
+                   (op.state == EG_OFF || op.state == EG_REV || op.state == EG_DMP ||
+                    ((op.state == EG_SUS || op.state == EG_REL) && !op.PRVB));
+    if (!settled) {
+        unsigned env = EG_MAX_WAIT;
+        switch (op.state) {
+        case EG_ATT:
+            if (op.AR_rate >= 4) {
+                env = maskWait(eg_cnt, op.AR_mask);
             }
-        }
-
-        // Notes:
-        // op.env_vol is in the range 0 .. MAX_ATT_INDEX (511)
-        // higher values mean more attenuation (lower volume)
-
-        // Envelope Generator
-        switch(op.state) {
-        case EG_ATT: {  // attack phase
-            if (op.AR_rate < 4 || (eg_cnt & op.AR_mask)) {
-                break;
+            break;
+        case EG_DEC:
+            if (op.D1R_rate >= 4) {
+                env = maskWait(eg_cnt, op.D1R_mask);
             }
-            op.env_vol += (~op.env_vol * eg_inc[op.AR_select + ((eg_cnt >> op.AR_shift) & 7)]) >> 3;
-            if (op.env_vol <= MIN_ATT_INDEX) {
-                op.env_vol = MIN_ATT_INDEX;
-                if (op.DL == 0) {
-                    op.state = EG_SUS;
-                }
-                else {
-                    op.state = EG_DEC;
-                }
+            break;
+        case EG_SUS:
+            if (op.D2R_rate >= 4) {
+                env = maskWait(eg_cnt, op.D2R_mask);
             }
             break;
-        }
-        case EG_DEC: {  // decay phase
-            if (op.D1R_rate < 4 || (eg_cnt & op.D1R_mask)) {
-                break;
+        case EG_REL:
+            if (op.RR_rate >= 4) {
+                env = maskWait(eg_cnt, op.RR_mask);
             }
-            op.env_vol += eg_inc[op.D1R_select + ((eg_cnt >> op.D1R_shift) & 7)];
+            break;
+        case EG_REV:
+            env = maskWait(eg_cnt, op.C5_mask);
+            break;
+        case EG_DMP:
+            env = maskWait(eg_cnt, dmp_mask);
+            break;
+        }
+        if (env < wait) {
+            wait = env;
+        }
+    }
 
-            if (((unsigned int)op.env_vol > dl_tab[6]) && op.PRVB) {
-                op.state = EG_REV;
-            } else {
-                if (op.env_vol >= op.DL) {
-                    op.state = EG_SUS;
-                }
-            }
+    if (op.active && op.lfo_active) {
+        // lfo_cnt is current, see syncLfo
+        unsigned lfo = op.lfo_cnt <= op.lfo_max ? (op.lfo_max - op.lfo_cnt) / 256 + 1 : 1;
+        if (lfo < wait) {
+            wait = lfo;
+        }
+    }
+
+    op.eg_next = eg_cnt + wait;
+    if ((uint16_t)(op.eg_next - eg_cnt) < (uint16_t)(eg_next - eg_cnt)) {
+        eg_next = op.eg_next;
+    }
+}
+
+// Process the slots that have an envelope or LFO event at the current
+// envelope counter, called when eg_cnt reaches eg_next
+void IRAM_ATTR YMF278::advance()
+{
+    eg_next = eg_cnt + EG_MAX_WAIT;
+    for (int i = 0; i < 24; i++) {
+        YMF278Slot &op = slots[i];
+        if (op.eg_next == eg_cnt) {
+            syncLfo(op);
+            stepEnvelope(op);
+            scheduleSlot(op);
+        } else if ((uint16_t)(op.eg_next - eg_cnt) < (uint16_t)(eg_next - eg_cnt)) {
+            eg_next = op.eg_next;
+        }
+    }
+}
+
+// One envelope generator step, a no-op unless eg_cnt hits the rate of the phase
+void IRAM_ATTR YMF278::stepEnvelope(YMF278Slot &op)
+{
+    int env_vol = op.env_vol;
+
+    // Notes:
+    // op.env_vol is in the range 0 .. MAX_ATT_INDEX (511)
+    // higher values mean more attenuation (lower volume)
+
+    // Envelope Generator
+    switch(op.state) {
+    case EG_ATT: {  // attack phase
+        if (op.AR_rate < 4 || (eg_cnt & op.AR_mask)) {
             break;
         }
-        case EG_SUS: {  // sustain phase
-            if (op.D2R_rate < 4 || (eg_cnt & op.D2R_mask)) {
-                break;
+        op.env_vol += (~op.env_vol * eg_inc[op.AR_select + ((eg_cnt >> op.AR_shift) & 7)]) >> 3;
+        if (op.env_vol <= MIN_ATT_INDEX) {
+            op.env_vol = MIN_ATT_INDEX;
+            if (op.DL == 0) {
+                op.state = EG_SUS;
             }
-            op.env_vol += eg_inc[op.D2R_select + ((eg_cnt >> op.D2R_shift) & 7)];
-            if (((unsigned int)op.env_vol > dl_tab[6]) && op.PRVB) {
-                op.state = EG_REV;
-            } else {
-                if (op.env_vol >= MAX_ATT_INDEX) {
-                    op.env_vol = MAX_ATT_INDEX;
-                    op.active = false;
-                    checkMute();
-                }
+            else {
+                op.state = EG_DEC;
             }
+        }
+        break;
+    }
+    case EG_DEC: {  // decay phase
+        if (op.D1R_rate < 4 || (eg_cnt & op.D1R_mask)) {
             break;
         }
-        case EG_REL: {  // release phase
-            if (op.RR_rate < 4 || (eg_cnt & op.RR_mask)) {
-                break;
-            }
-            op.env_vol += eg_inc[op.RR_select + ((eg_cnt >> op.RR_shift) & 7)];
-            if (((unsigned int)op.env_vol > dl_tab[6]) && op.PRVB) {
-                op.state = EG_REV;
-            } else {
-                if (op.env_vol >= MAX_ATT_INDEX) {
-                    op.env_vol = MAX_ATT_INDEX;
-                    op.active = false;
-                    checkMute();
-                }
+        op.env_vol += eg_inc[op.D1R_select + ((eg_cnt >> op.D1R_shift) & 7)];
+
+        if (((unsigned int)op.env_vol > dl_tab[6]) && op.PRVB) {
+            op.state = EG_REV;
+        } else {
+            if (op.env_vol >= op.DL) {
+                op.state = EG_SUS;
             }
+        }
+        break;
+    }
+    case EG_SUS: {  // sustain phase
+        if (op.D2R_rate < 4 || (eg_cnt & op.D2R_mask)) {
             break;
         }
-        case EG_REV: {  //pseudo reverb
-            //TODO improve env_vol update
-            //if (op.C5_rate < 4) {
-            //  break;
-            //}
-            if (eg_cnt & op.C5_mask) {
-                break;
-            }
-            op.env_vol += eg_inc[op.C5_select + ((eg_cnt >> op.C5_shift) & 7)];
+        op.env_vol += eg_inc[op.D2R_select + ((eg_cnt >> op.D2R_shift) & 7)];
+        if (((unsigned int)op.env_vol > dl_tab[6]) && op.PRVB) {
+            op.state = EG_REV;
+        } else {
             if (op.env_vol >= MAX_ATT_INDEX) {
                 op.env_vol = MAX_ATT_INDEX;
                 op.active = false;
                 checkMute();
             }
+        }
+        break;
+    }
+    case EG_REL: {  // release phase
+        if (op.RR_rate < 4 || (eg_cnt & op.RR_mask)) {
             break;
         }
-        case EG_DMP: {  //damping
-            //TODO improve env_vol update, damp is just fastest decay now
-            if (eg_cnt & dmp_mask) {
-                break;
-            }
-            op.env_vol += eg_inc[dmp_select + ((eg_cnt >> dmp_shift) & 7)];
-
+        op.env_vol += eg_inc[op.RR_select + ((eg_cnt >> op.RR_shift) & 7)];
+        if (((unsigned int)op.env_vol > dl_tab[6]) && op.PRVB) {
+            op.state = EG_REV;
+        } else {
             if (op.env_vol >= MAX_ATT_INDEX) {
                 op.env_vol = MAX_ATT_INDEX;
                 op.active = false;
                 checkMute();
             }
+        }
+        break;
+    }
+    case EG_REV: {  //pseudo reverb
+        //TODO improve env_vol update
+        //if (op.C5_rate < 4) {
+        //  break;
+        //}
+        if (eg_cnt & op.C5_mask) {
             break;
         }
-        case EG_OFF:
-            // nothing
+        op.env_vol += eg_inc[op.C5_select + ((eg_cnt >> op.C5_shift) & 7)];
+        if (op.env_vol >= MAX_ATT_INDEX) {
+            op.env_vol = MAX_ATT_INDEX;
+            op.active = false;
+            checkMute();
+        }
+        break;
+    }
+    case EG_DMP: {  //damping
+        //TODO improve env_vol update, damp is just fastest decay now
+        if (eg_cnt & dmp_mask) {
             break;
+        }
+        op.env_vol += eg_inc[dmp_select + ((eg_cnt >> dmp_shift) & 7)];
 
-        default:
-            break;
+        if (op.env_vol >= MAX_ATT_INDEX) {
+            op.env_vol = MAX_ATT_INDEX;
+            op.active = false;
+            checkMute();
         }
+        break;
+    }
+    case EG_OFF:
+        // nothing
+        break;
+
+    default:
+        break;
+    }
+    if (op.env_vol != env_vol) {
+        op.dirty |= SLOT_DIRTY_GAIN;
     }
 }
 
-int16_t IRAM_ATTR YMF278::getSample(YMF278Slot &op)
+// Restart the sample stream of a slot at the given position
+inline void YMF278::restartRing(YMF278Slot &op, int pos)
+{
+    op.ring_rd = op.ring_wr = 0;
+    op.fillpos = pos;
+}
+
+template <int BITS>
+static inline int16_t decodeSample(const YMF278Slot &op, int p)
+{
+    if constexpr (BITS == 0) { // 8 bit
+        return op.sampleptr[p] << 8;
+    } else if constexpr (BITS == 1) { // 12 bit, two samples packed in three bytes
+        const uint8_t* b = op.sampleptr + (p >> 1) * 3;
+        return (p & 1) ? ((b[2] << 8) | ((b[1] << 4) & 0xF0)) :
+                         ((b[0] << 8) | (b[1] & 0xF0));
+    } else if constexpr (BITS == 2) { // 16 bit
+        return op.sampleptr16[p];
+    } else {
+        // TODO unspecified
+        return 0;
+    }
+}
+
+// Single sample in the format of the slot, outside the stream
+static int16_t IRAM_ATTR readSample(const YMF278Slot &op, int p)
 {
-    int16_t sample;
     switch (op.bits) {
-    case 0: // 8 bit
-        sample = op.sampleptr[op.pos] << 8;
-        break;
+    case 0:
+        return decodeSample<0>(op, p);
+    case 1:
+        return decodeSample<1>(op, p);
+    case 2:
+        return decodeSample<2>(op, p);
+    default:
+        return decodeSample<3>(op, p);
+    }
+}
 
-    case 1: // 12 bit
-    case 2: // 16 bit
-        sample = op.sampleptr16[op.pos];
-        break;
+// Top up the sample stream of a slot from ROM/RAM. The samples are decoded
+// in runs up to the end address, following the loop the same way the
+// render loop advances pos, so rendering only reads internal memory.
+template <int BITS>
+void IRAM_ATTR YMF278::fillRingBits(YMF278Slot &op)
+{
+    unsigned n = YMF278_RING_SIZE - (op.ring_wr - op.ring_rd);
+    while (n) {
+        unsigned run = op.endaddr > op.fillpos ? op.endaddr - op.fillpos : 1;
+        if (run > n) {
+            run = n;
+        }
 
+        unsigned wr = op.ring_wr;
+        int p = op.fillpos;
+        for (unsigned i = 0; i < run; i++, p++) {
+            op.ring[wr++ & (YMF278_RING_SIZE - 1)] = decodeSample<BITS>(op, p);
+        }
+
+        op.ring_wr = wr;
+        op.fillpos = p >= op.endaddr ? op.loopaddr : p;
+        n -= run;
+    }
+}
+
+// Select the fill loop for the sample format once per fill
+void IRAM_ATTR YMF278::fillRing(YMF278Slot &op)
+{
+    switch (op.bits) {
+    case 0:
+        fillRingBits<0>(op);
+        break;
+    case 1:
+        fillRingBits<1>(op);
+        break;
+    case 2:
+        fillRingBits<2>(op);
+        break;
     default:
-        // TODO unspecified
-        sample = 0;
+        fillRingBits<3>(op);
+        break;
     }
-    return sample;
+}
+
+inline int16_t YMF278::nextSample(YMF278Slot &op)
+{
+    return op.ring[op.ring_rd++ & (YMF278_RING_SIZE - 1)];
 }
 
 void IRAM_ATTR YMF278::checkMute()
 {
+    // called when a slot turns off
+    activeDirty = true;
     setInternalMute(!anyActive());
 }
 
+void IRAM_ATTR YMF278::updateActiveList()
+{
+    activeCount = 0;
+    for (int i = 0; i < 24; i++) {
+        if (slots[i].active || slots[i].transition) {
+            activeList[activeCount++] = &slots[i];
+        }
+    }
+    activeDirty = false;
+}
+
+// Recompute the output gains and the step of a slot after a change
+void IRAM_ATTR YMF278::refreshSlot(YMF278Slot& sl)
+{
+    if (sl.dirty & SLOT_DIRTY_GAIN) {
+        int vol = sl.TL + (sl.env_vol >> 2) + sl.compute_am();
+
+        int volLeft  = vol + pan_left [(int)sl.pan] + mix_level[pcm_l];
+        int volRight = vol + pan_right[(int)sl.pan] + mix_level[pcm_r];
+
+        // TODO prob doesn't happen in real chip
+        if (volLeft < 0) {
+            volLeft = 0;
+        }
+        if (volRight < 0) {
+            volRight = 0;
+        }
+
+        sl.gain_l = volume[volLeft];
+        sl.gain_r = volume[volRight];
+    }
+
+    if (sl.dirty & SLOT_DIRTY_STEP) {
+        if (sl.lfo_active && sl.vib) {
+            int oct = sl.OCT;
+            if (oct & 8) {
+                oct |= -8;
+            }
+            oct += 5;
+            int v = sl.compute_vib();
+            sl.cur_step = oct >= 0 ? ((sl.FN | 1024) + v) << oct
+                                   : ((sl.FN | 1024) + v) >> -oct;
+        } else {
+            sl.cur_step = sl.step;
+        }
+    }
+
+    sl.dirty = 0;
+}
+
+void YMF278::setAllDirty()
+{
+    for (int i = 0; i < 24; i++) {
+        slots[i].dirty = SLOT_DIRTY_GAIN | SLOT_DIRTY_STEP;
+    }
+}
+
 bool YMF278::anyActive()
 {
     for (int i = 0; i < 24; i++) {
@@ -454,62 +694,47 @@ int* IRAM_ATTR YMF278::updateBuffer(int *buffer, int length)
         return NULL;
     }
 
-    int vl = mix_level[pcm_l];
-    int vr = mix_level[pcm_r];
     int *buf = buffer;
     while (length--) {
         int left = 0;
         int right = 0;
-        for (int i = 0; i < 24; i++) {
-            YMF278Slot &sl = slots[i];
+        if (activeDirty) {
+            updateActiveList();
+        }
+        for (int i = 0; i < activeCount; i++) {
+            YMF278Slot &sl = *activeList[i];
             if (!sl.active) {
                 // Finish any sample transition postponed writes
                 if (sl.transition) {
                     handlePostponedRegs(sl);
+                    activeDirty = true;
                 }
                 continue;
             }
 
+            if (sl.dirty) {
+                refreshSlot(sl);
+            }
+
             int16_t sample = (sl.sample1 * (0x10000 - sl.stepptr) +
                               sl.sample2 * sl.stepptr) >> 16;
-            int vol = sl.TL + (sl.env_vol >> 2) + sl.compute_am();
+            left  += (sample * sl.gain_l) >> 10;
+            right += (sample * sl.gain_r) >> 10;
 
-            int volLeft  = vol + pan_left [(int)sl.pan] + vl;
-            int volRight = vol + pan_right[(int)sl.pan] + vr;
+            sl.stepptr += sl.cur_step;
 
-            // TODO prob doesn't happen in real chip
-            if (volLeft < 0) {
-                volLeft = 0;
-            }
-            if (volRight < 0) {
-                volRight = 0;
-            }
-
-            left  += (sample * volume[volLeft] ) >> 10;
-            right += (sample * volume[volRight]) >> 10;
-
-            if (sl.lfo_active && sl.vib) {
-                int oct = sl.OCT;
-                if (oct & 8) {
-                    oct |= -8;
-                }
-                oct += 5;
-                int v = sl.compute_vib();
-                sl.stepptr += (oct >= 0 ? ((sl.FN | 1024) + v) << oct
-                                : ((sl.FN | 1024) + v) >> -oct);
-            } else {
-                sl.stepptr += sl.step;
-            }
-
-            int count = (sl.stepptr >> 16) & 0x0f;
+            unsigned count = (sl.stepptr >> 16) & 0x0f;
             sl.stepptr &= 0xffff;
+            if (count > sl.ring_wr - sl.ring_rd) {
+                fillRing(sl);
+            }
             while (count--) {
                 sl.sample1 = sl.sample2;
                 sl.pos++;
                 if (sl.pos >= sl.endaddr) {
                     sl.pos = sl.loopaddr;
                 }
-                sl.sample2 = getSample(sl);
+                sl.sample2 = nextSample(sl);
             }
 
             // Handle sample transition postponed writes at zero crossing
@@ -519,7 +744,9 @@ int* IRAM_ATTR YMF278::updateBuffer(int *buffer, int length)
                 handlePostponedRegs(sl);
             }
         }
-        advance();
+        if (++eg_cnt == eg_next) {
+            advance();
+        }
         *buf++ = left;
         *buf++ = right;
     }
@@ -529,6 +756,7 @@ int* IRAM_ATTR YMF278::updateBuffer(int *buffer, int length)
 void IRAM_ATTR YMF278::keyOnHelper(YMF278Slot& slot)
 {
     slot.active = true;
+    activeDirty = true;
     setInternalMute(false);
 
     int oct = slot.OCT;
@@ -537,12 +765,16 @@ void IRAM_ATTR YMF278::keyOnHelper(YMF278Slot& slot)
     }
     oct += 5;
     slot.step = oct >= 0 ? (slot.FN | 1024) << oct : (slot.FN | 1024) >> -oct;
+    slot.dirty |= SLOT_DIRTY_STEP;
     slot.state = EG_ATT;
     slot.stepptr = 0;
-    slot.pos = 0;
-    slot.sample1 = getSample(slot);
+    // The first sample is read on its own, the stream starts at pos 1 and
+    // follows the end/loop addresses from there like pos does
+    slot.sample1 = readSample(slot, 0);
     slot.pos = 1;
-    slot.sample2 = getSample(slot);
+    restartRing(slot, slot.pos);
+    fillRing(slot);
+    slot.sample2 = nextSample(slot);
 }
 
 void IRAM_ATTR YMF278::handlePostponedRegs(YMF278Slot& slot)
@@ -565,7 +797,7 @@ void IRAM_ATTR YMF278::writeRegOPL4(uint8_t reg, uint8_t data, bool isPostponed)
 
         // Postpone writes during sample transition
         if (slot.transition) {
-            if (slot.transition_index >= sizeof(slot.transition_reg)) {
+            if (slot.transition_index >= (int)sizeof(slot.transition_reg)) {
                 // Not expected to happen, when it does, write all the postponed regs now
                 ESP_LOGW(TAG, "Preventing transition buffer overflow");
                 handlePostponedRegs(slot);
@@ -586,6 +818,10 @@ void IRAM_ATTR YMF278::writeRegOPL4(uint8_t reg, uint8_t data, bool isPostponed)
             return;
         }
 
+        // any slot register may affect the gains, the step or the envelope
+        slot.dirty = SLOT_DIRTY_GAIN | SLOT_DIRTY_STEP;
+        syncLfo(slot);
+
         switch ((reg - 8) / 24) {
         case 0: {
             bool key_on = (regs[reg + 4] & 0x080);
@@ -612,21 +848,16 @@ void IRAM_ATTR YMF278::writeRegOPL4(uint8_t reg, uint8_t data, bool isPostponed)
             while (startaddr >= endRam) {
                 startaddr -= (endRam - endRom); // Wrap-around RAM, TODO check
             }
-            if (slot.bits == 1) {
-                if (startaddr < endRom) {
-                    slot.sampleptr = rom12bit + (startaddr * 4) / 3;
-                }else{
-                    slot.sampleptr = ram12bit + ((startaddr - endRom) * 4) / 3;
-                }
-            }else{
-                if (startaddr < endRom) {
-                    slot.sampleptr = rom + startaddr;
-                } else {
-                    slot.sampleptr = ram + (startaddr - endRom);
-                }
+            if (startaddr < endRom) {
+                slot.sampleptr = rom + startaddr;
+            } else {
+                slot.sampleptr = ram + (startaddr - endRom);
             }
             slot.loopaddr = buf[4] + (buf[3] << 8);
             slot.endaddr  = (((buf[6] + (buf[5] << 8)) ^ 0xFFFF) + 1);
+            // continue with the new sample data after the current sample
+            int next = slot.pos + 1;
+            restartRing(slot, next >= slot.endaddr ? slot.loopaddr : next);
 
             slot.update_AR();
             slot.update_D1R();
@@ -745,6 +976,7 @@ void IRAM_ATTR YMF278::writeRegOPL4(uint8_t reg, uint8_t data, bool isPostponed)
             slot.AM = data & 0x7;
             break;
         }
+        scheduleSlot(slot);
     } else {
         // All non-slot registers
         switch (reg) {
@@ -783,6 +1015,7 @@ void IRAM_ATTR YMF278::writeRegOPL4(uint8_t reg, uint8_t data, bool isPostponed)
         case 0xF9:
             pcm_l = data & 0x7;
             pcm_r = (data >> 3) & 0x7;
+            setAllDirty();
             break;
         }
     }
@@ -820,46 +1053,30 @@ YMF278::YMF278(int ramSize, void* romData, int romSize)
     assert(ram != NULL);
     memset(ram, 0, ramSize);
 
-    ram12bit = (uint8_t*)heap_caps_malloc(ramSize * 4 / 3, MALLOC_CAP_SPIRAM);
-    assert(ram12bit != NULL);
-    memset(ram12bit, 0, ramSize * 4 / 3);
-
     endRam = endRom + ramSize;
 
-    rom12bit = (uint8_t*)heap_caps_malloc(romSize * 4 / 3, MALLOC_CAP_SPIRAM);
-    assert(rom12bit != NULL);
-
-    uint16_t *p = (uint16_t*)rom12bit;
-    for(int i = 0; i < romSize * 4 / 6; i++) {
-        int addr = ((i / 2) * 3);
-        if (i & 1) {
-            *p++ = rom[addr + 2] << 8 |
-                 ((rom[addr + 1] << 4) & 0xF0);
-        } else {
-            *p++ = rom[addr + 0] << 8 |
-                 (rom[addr + 1] & 0xF0);
-        }
-    }
-
     reset();
 }
 
 YMF278::~YMF278()
 {
-    heap_caps_free(rom12bit);
-    heap_caps_free(ram12bit);
     heap_caps_free(ram);
 }
 
 void YMF278::reset()
 {
     eg_cnt   = 0;
+    eg_next  = EG_MAX_WAIT;
 
     int i;
     for (i = 0; i < 24; i++) {
         slots[i].reset();
         slots[i].sampleptr = rom;
+        slots[i].lfo_time = eg_cnt;
+        scheduleSlot(slots[i]);
     }
+    activeCount = 0;
+    activeDirty = false;
     for (i = 255; i >= 0; i--) { // reverse order to avoid UMR
         writeRegOPL4(i, 0);
     }
@@ -868,7 +1085,7 @@ void YMF278::reset()
     fm_l = fm_r = pcm_l = pcm_r = 0;
 }
 
-void YMF278::setSampleRate(int sampleRate, int Oversampling)
+void YMF278::setSampleRate(int /*sampleRate*/, int /*Oversampling*/)
 {
 }
 
@@ -883,6 +1100,7 @@ void YMF278::setInternalVolume(int16_t newVolume)
     for (i = 256; i < 256 * 4; i++) {
         volume[i] = 0;
     }
+    setAllDirty();
 }
 
 uint8_t IRAM_ATTR YMF278::readMem(unsigned int address)
@@ -903,20 +1121,13 @@ void IRAM_ATTR YMF278::writeMem(unsigned int address, uint8_t value)
         // can't write to ROM
     } else if (address < endRam) {
         ram[address - endRom] = value;
-        // update 12-bit version
-        int part = (address - endRom) % 3;
-        int addr = ((address - endRom) / 3) * 4;
-        switch (part) {
-        case 0:
-            *(uint16_t*)&ram12bit[addr] = (*(uint16_t*)&ram12bit[addr] & 0xf000) | (value << 4);
-            break;
-        case 1:
-            ram12bit[addr + 1] = (ram12bit[addr + 1] & 0x0f) | (value << 4);
-            ram12bit[addr + 2] = value & 0xf0;
-            break;
-        case 2:
-            ram12bit[addr + 3] = value;
-            break;
+        // drop the samples streamed ahead from RAM, they may be stale
+        for (int i = 0; i < 24; i++) {
+            YMF278Slot &sl = slots[i];
+            if (sl.active && sl.sampleptr >= ram && sl.sampleptr < ram + ramSize) {
+                int next = sl.pos + 1;
+                restartRing(sl, next >= sl.endaddr ? sl.loopaddr : next);
+            }
         }
     } else {
         // can't write to unmapped memory
@@ -39,6 +39,9 @@ class SoundDevice
 #endif
 
 
+// Samples streamed ahead per slot, must be a power of 2
+static const int YMF278_RING_SIZE = 128;
+
 class YMF278Slot
 {
     public:
@@ -113,16 +116,30 @@ class YMF278Slot
         int loopaddr;
         int endaddr;
 
+        // samples streamed ahead from ROM/RAM, starting at the sample after sample2
+        int fillpos;        // position of the next sample to stream
+        unsigned ring_rd;
+        unsigned ring_wr;
+        int16_t ring[YMF278_RING_SIZE];
+
         uint8_t state;
+        uint16_t eg_next;   // eg_cnt of the next envelope step or LFO tick
         int16_t env_vol;
         uint16_t env_vol_step;
         uint16_t env_vol_lim;
 
         bool lfo_active;
+        uint16_t lfo_time;  // eg_cnt up to which the LFO is current
         int lfo_cnt;
         int lfo_idx;
         int lfo_step;
         int lfo_max;
+
+        // output gains and step including AM and vibrato, refreshed when dirty
+        uint8_t dirty;
+        int gain_l;
+        int gain_r;
+        int cur_step;
 };
 
 static const int MASTER_CLK = 33868800;
@@ -135,6 +152,8 @@ class YMF278 : public SoundDevice
         void reset();
         void writeRegOPL4(uint8_t reg, uint8_t data, bool isPostponed = false);
         uint8_t readRegOPL4(uint8_t reg);
+        // Memory contents without touching the chip state
+        uint8_t peekMem(unsigned int address) { return readMem(address); }
         virtual void setSampleRate(int sampleRate, int Oversampling);
         virtual void setInternalVolume(int16_t newVolume);
         virtual int* updateBuffer(int *buffer, int length);
@@ -143,22 +162,35 @@ class YMF278 : public SoundDevice
         void handlePostponedRegs(YMF278Slot& slot);
         uint8_t readMem(unsigned int address);
         void writeMem(unsigned int address, uint8_t value);
-        int16_t getSample(YMF278Slot &op);
+        inline void restartRing(YMF278Slot &op, int pos);
+        void fillRing(YMF278Slot &op);
+        template <int BITS> void fillRingBits(YMF278Slot &op);
+        inline int16_t nextSample(YMF278Slot &op);
         void advance();
+        void syncLfo(YMF278Slot &op);
+        void scheduleSlot(YMF278Slot &op);
+        void stepEnvelope(YMF278Slot &op);
         void checkMute();
         bool anyActive();
         void keyOnHelper(YMF278Slot& slot);
+        void refreshSlot(YMF278Slot& slot);
+        void setAllDirty();
+        void updateActiveList();
 
         uint8_t* rom;
         uint8_t* ram;
-        uint8_t* ram12bit;
-        uint8_t* rom12bit;
 
         YMF278Slot slots[24];
 
+        // slots to render, keyed on or with postponed writes pending
+        YMF278Slot* activeList[24];
+        int activeCount;
+        bool activeDirty;
+
         int ramSize;
         
         uint16_t eg_cnt;    // global envelope generator counter
+        uint16_t eg_next;   // eg_cnt of the next slot event
         
         char wavetblhdr;
         char memmode;
@@ -0,0 +1,185 @@
+/*
+  Fixed-point polyphase resampler
+*/
+#include "Resampler.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COEF_BITS   14
+// Inputs are kept split in a high part (x >> LO_BITS) and the low LO_BITS,
+// both 16-bit, so every tap is two 16x16 multiply-accumulates into 32 bits
+// and the sum is still exact: (x * h) >> COEF_BITS of the full input.
+#define LO_BITS     15
+#define LO_MASK     ((1 << LO_BITS) - 1)
+// Largest input that keeps the high part in 16 bits
+#define INPUT_MAX   ((1 << (LO_BITS + 15)) - 1)
+// Pass band edge relative to the output Nyquist frequency
+#define CUTOFF      0.91
+
+#define MAX_INPUT   (2 * RESAMPLER_BLOCK + 1)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+struct Resampler {
+    MixerUpdateCallback source;
+    void*  ref;
+    UInt32 step;      // whole input samples per output sample
+    UInt32 stepFrac;  // fraction of an input sample per output sample (0.32)
+    UInt32 phase;     // position between input samples (0.32)
+    UInt32 quiet;     // trailing silent samples in the input buffer
+    Int16  coefs[RESAMPLER_PHASES][RESAMPLER_TAPS];
+    // RESAMPLER_TAPS samples of history followed by the new input
+    Int16  inputHi[2 * (RESAMPLER_TAPS + MAX_INPUT)];
+    Int16  inputLo[2 * (RESAMPLER_TAPS + MAX_INPUT)];
+    Int32  gen[2 * MAX_INPUT];
+};
+
+static void resamplerInitCoefs(Resampler* rs, double ratio)
+{
+    double fc = CUTOFF * (ratio < 1.0 ? ratio : 1.0);
+
+    for (int p = 0; p < RESAMPLER_PHASES; p++) {
+        // Output sample lies between input taps TAPS/2 - 1 and TAPS/2
+        double center = RESAMPLER_TAPS / 2 - 1 + (double)p / RESAMPLER_PHASES;
+        double h[RESAMPLER_TAPS];
+        double sum = 0.0;
+
+        for (int t = 0; t < RESAMPLER_TAPS; t++) {
+            double x = t - center;
+            double sinc = x == 0.0 ? 1.0 : sin(M_PI * fc * x) / (M_PI * fc * x);
+            // Blackman window over the filter span
+            double w = 2.0 * M_PI * x / (RESAMPLER_TAPS + 1);
+            double window = 0.42 + 0.5 * cos(w) + 0.08 * cos(2.0 * w);
+            h[t] = sinc * window;
+            sum += h[t];
+        }
+
+        // Unity gain for every phase, put the rounding error in the center tap
+        Int32 total = 0;
+        for (int t = 0; t < RESAMPLER_TAPS; t++) {
+            rs->coefs[p][t] = (Int16)lround(h[t] / sum * (1 << COEF_BITS));
+            total += rs->coefs[p][t];
+        }
+        rs->coefs[p][RESAMPLER_TAPS / 2 - 1 + (p >= RESAMPLER_PHASES / 2)] += (1 << COEF_BITS) - total;
+
+        // Both partial sums stay in 32 bits while the taps sum to less than 4.0
+        Int32 magnitude = 0;
+        for (int t = 0; t < RESAMPLER_TAPS; t++) {
+            magnitude += abs(rs->coefs[p][t]);
+        }
+        assert(magnitude < (4 << COEF_BITS));
+    }
+}
+
+Resampler* resamplerCreate(UInt32 clock, UInt32 divider, UInt32 outRate, MixerUpdateCallback source, void* ref)
+{
+    UInt64 den = (UInt64)divider * outRate;
+    assert(clock <= 2 * den);
+
+    Resampler* rs = (Resampler*)calloc(1, sizeof(Resampler));
+    if (rs == NULL) {
+        return NULL;
+    }
+
+    rs->source = source;
+    rs->ref = ref;
+    rs->step = (UInt32)(clock / den);
+    rs->stepFrac = (UInt32)((((UInt64)clock % den) << 32) / den);
+    rs->quiet = RESAMPLER_TAPS;
+
+    resamplerInitCoefs(rs, (double)den / clock);
+
+    return rs;
+}
+
+void resamplerDestroy(Resampler* rs)
+{
+    free(rs);
+}
+
+static bool IRAM_ATTR resamplerBlock(Resampler* rs, Int32* buffer, UInt32 count)
+{
+    // Input samples consumed by this block
+    UInt32 length = count * rs->step + (UInt32)(((UInt64)rs->phase + (UInt64)count * rs->stepFrac) >> 32);
+    Int16* inputHi = rs->inputHi + 2 * RESAMPLER_TAPS;
+    Int16* inputLo = rs->inputLo + 2 * RESAMPLER_TAPS;
+
+    if (length > 0) {
+        Int32* gen = rs->source(rs->ref, rs->gen, length);
+        if (gen == NULL) {
+            memset(inputHi, 0, 2 * length * sizeof(Int16));
+            memset(inputLo, 0, 2 * length * sizeof(Int16));
+            rs->quiet = MIN(rs->quiet + length, RESAMPLER_TAPS + MAX_INPUT);
+        } else {
+            for (UInt32 i = 0; i < 2 * length; i++) {
+                Int32 v = gen[i];
+                v = v > INPUT_MAX ? INPUT_MAX : v < -INPUT_MAX - 1 ? -INPUT_MAX - 1 : v;
+                inputHi[i] = (Int16)(v >> LO_BITS);
+                inputLo[i] = (Int16)(v & LO_MASK);
+            }
+            rs->quiet = 0;
+        }
+    }
+
+    bool active = rs->quiet < RESAMPLER_TAPS + length;
+    if (active) {
+        const Int16* hi = rs->inputHi;
+        const Int16* lo = rs->inputLo;
+        UInt32 phase = rs->phase;
+        for (UInt32 i = 0; i < count; i++) {
+            const Int16* h = rs->coefs[phase >> (32 - RESAMPLER_PHASE_BITS)];
+            Int32 leftHi = 0;
+            Int32 rightHi = 0;
+            Int32 leftLo = 0;
+            Int32 rightLo = 0;
+            for (int t = 0; t < RESAMPLER_TAPS; t++) {
+                leftHi  += h[t] * hi[2 * t];
+                rightHi += h[t] * hi[2 * t + 1];
+                leftLo  += h[t] * lo[2 * t];
+                rightLo += h[t] * lo[2 * t + 1];
+            }
+            // (hi << LO_BITS) + lo, shifted down by COEF_BITS
+            *buffer++ = leftHi * (1 << (LO_BITS - COEF_BITS)) + (leftLo >> COEF_BITS);
+            *buffer++ = rightHi * (1 << (LO_BITS - COEF_BITS)) + (rightLo >> COEF_BITS);
+
+            UInt32 next = phase + rs->stepFrac;
+            UInt32 advance = 2 * (rs->step + (next < phase));
+            hi += advance;
+            lo += advance;
+            phase = next;
+        }
+    }
+    rs->phase += count * rs->stepFrac;
+
+    // Keep the last input samples as history for the next block
+    memmove(rs->inputHi, rs->inputHi + 2 * length, 2 * RESAMPLER_TAPS * sizeof(Int16));
+    memmove(rs->inputLo, rs->inputLo + 2 * length, 2 * RESAMPLER_TAPS * sizeof(Int16));
+
+    return active;
+}
+
+Int32* IRAM_ATTR resamplerRender(Resampler* rs, Int32* buffer, UInt32 count)
+{
+    UInt32 done = 0;
+    bool active = false;
+
+    while (done < count) {
+        UInt32 length = MIN(count - done, RESAMPLER_BLOCK);
+        Int32* segment = buffer + 2 * done;
+
+        if (resamplerBlock(rs, segment, length)) {
+            if (!active && done > 0) {
+                memset(buffer, 0, 2 * done * sizeof(Int32));
+            }
+            active = true;
+        } else if (active) {
+            memset(segment, 0, 2 * length * sizeof(Int32));
+        }
+        done += length;
+    }
+
+    return active ? buffer : NULL;
+}
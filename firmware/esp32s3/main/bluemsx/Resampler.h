@@ -0,0 +1,34 @@
+/*
+  Fixed-point polyphase resampler
+
+  Converts the output of a chip running at its native rate (two values per
+  sample, stereo or voice + drum) to the mixer rate. The input rate is given
+  as clock / divider, e.g. 3579545 / 72 for the YM2413, so the position
+  between input samples can be tracked exactly. Every output sample is a
+  RESAMPLER_TAPS tap windowed sinc over the input, with the filter taken
+  from one of RESAMPLER_PHASES precomputed fractional positions.
+*/
+#pragma once
+
+#include "MsxTypes.h"
+#include "AudioMixer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESAMPLER_TAPS        16  // input samples per output sample, must be even
+#define RESAMPLER_PHASE_BITS  8
+#define RESAMPLER_PHASES      (1 << RESAMPLER_PHASE_BITS)
+#define RESAMPLER_BLOCK       128 // output samples rendered per source call
+
+typedef struct Resampler Resampler;
+
+/* Source renders native rate samples, the input rate may be at most twice outRate */
+Resampler* resamplerCreate(UInt32 clock, UInt32 divider, UInt32 outRate, MixerUpdateCallback source, void* ref);
+void resamplerDestroy(Resampler* rs);
+Int32* resamplerRender(Resampler* rs, Int32* buffer, UInt32 count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,175 @@
+/*
+  Timestamped register write queue
+*/
+#include "WriteQueue.h"
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+static inline WriteQueueEntry* writeQueuePeek(WriteQueue* queue)
+{
+    UInt32 wrIdx = __atomic_load_n(&queue->wrIdx, __ATOMIC_ACQUIRE);
+    if (queue->rdIdx == wrIdx) {
+        // empty
+        return NULL;
+    }
+    return &queue->entries[queue->rdIdx & (WRITE_QUEUE_SIZE - 1)];
+}
+
+static inline void writeQueuePop(WriteQueue* queue)
+{
+    __atomic_store_n(&queue->rdIdx, queue->rdIdx + 1, __ATOMIC_RELEASE);
+}
+
+static inline bool writeQueuePush(WriteQueue* queue, UInt32 time, UInt16 reg, UInt8 value)
+{
+    UInt32 rdIdx = __atomic_load_n(&queue->rdIdx, __ATOMIC_ACQUIRE);
+    if (queue->wrIdx - rdIdx == WRITE_QUEUE_SIZE) {
+        // full
+        return false;
+    }
+    WriteQueueEntry* entry = &queue->entries[queue->wrIdx & (WRITE_QUEUE_SIZE - 1)];
+    entry->time = time;
+    entry->reg = reg;
+    entry->value = value;
+    __atomic_store_n(&queue->wrIdx, queue->wrIdx + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void writeQueueInit(WriteQueue* queue, Mixer* mixer, WriteQueueApplyCallback callback, void* ref)
+{
+    queue->mixer = mixer;
+    queue->applyCallback = callback;
+    queue->ref = ref;
+    queue->rdIdx = 0;
+    queue->wrIdx = 0;
+    queue->waiting = 0;
+    queue->drained = xSemaphoreCreateBinary();
+}
+
+void writeQueueDestroy(WriteQueue* queue)
+{
+    vSemaphoreDelete(queue->drained);
+}
+
+void IRAM_ATTR writeQueueWrite(WriteQueue* queue, UInt16 reg, UInt8 value)
+{
+    UInt32 time = mixerGetSampleTime(queue->mixer);
+
+    if (writeQueuePush(queue, time, reg, value)) {
+        return;
+    }
+
+    // Queue full. The mixer renders at the I2S clock and applies the writes
+    // once it reaches their sample time, wait until it has rendered a block
+    // so they stay in place. The timeout only catches the mixer being
+    // disabled meanwhile.
+    while (mixerIsEnabled(queue->mixer)) {
+        // Announce the wait before checking for room again, the consumer
+        // checks in the opposite order, so one of both sees the other
+        __atomic_store_n(&queue->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (writeQueuePush(queue, time, reg, value)) {
+            __atomic_store_n(&queue->waiting, 0, __ATOMIC_RELAXED);
+            return;
+        }
+        xSemaphoreTake(queue->drained, 1);
+    }
+    __atomic_store_n(&queue->waiting, 0, __ATOMIC_RELAXED);
+
+    // Mixer is disabled and doesn't render the chips, apply directly
+    mixerLock(queue->mixer);
+    writeQueueFlush(queue);
+    mixerUnlock(queue->mixer);
+    writeQueuePush(queue, time, reg, value);
+}
+
+// Apply all queued writes, caller must make sure the chip is not rendering (mixerLock)
+void IRAM_ATTR writeQueueFlush(WriteQueue* queue)
+{
+    WriteQueueEntry* entry;
+    while ((entry = writeQueuePeek(queue)) != NULL) {
+        queue->applyCallback(queue->ref, entry->reg, entry->value);
+        writeQueuePop(queue);
+    }
+}
+
+// Apply the queued writes before the given position, the later ones stay
+// queued for their sample time. Caller must make sure the chip is not
+// rendering (mixerLock).
+void IRAM_ATTR writeQueueFlushTo(WriteQueue* queue, UInt32 position)
+{
+    WriteQueueEntry* entry;
+    while ((Int32)(queue->rdIdx - position) < 0 && (entry = writeQueuePeek(queue)) != NULL) {
+        queue->applyCallback(queue->ref, entry->reg, entry->value);
+        writeQueuePop(queue);
+    }
+}
+
+// Position after the last queued write to a register equal to reg under
+// mask, an already applied position if there is none. Only valid on the
+// producer side, the consumer never changes queued entries.
+UInt32 IRAM_ATTR writeQueueLastWrite(WriteQueue* queue, UInt16 reg, UInt16 mask)
+{
+    UInt32 rdIdx = __atomic_load_n(&queue->rdIdx, __ATOMIC_ACQUIRE);
+    for (UInt32 idx = queue->wrIdx; idx != rdIdx; idx--) {
+        WriteQueueEntry* entry = &queue->entries[(idx - 1) & (WRITE_QUEUE_SIZE - 1)];
+        if (((entry->reg ^ reg) & mask) == 0) {
+            return idx;
+        }
+    }
+    return rdIdx;
+}
+
+// Render a mixer block, splitting it at the sample positions of the queued writes
+Int32* IRAM_ATTR writeQueueRender(WriteQueue* queue, MixerUpdateCallback render, Int32* buffer, UInt32 count)
+{
+    UInt32 time = mixerGetBlockTime(queue->mixer);
+    UInt32 done = 0;
+    bool active = false;
+
+    while (done < count) {
+        UInt32 length = count - done;
+
+        // Apply the writes that are due, stop at the first one in the future
+        WriteQueueEntry* entry;
+        while ((entry = writeQueuePeek(queue)) != NULL) {
+            Int32 offset = (Int32)(entry->time - time);
+            if (offset > (Int32)done) {
+                if ((UInt32)offset - done < length) {
+                    length = (UInt32)offset - done;
+                }
+                break;
+            }
+            queue->applyCallback(queue->ref, entry->reg, entry->value);
+            writeQueuePop(queue);
+        }
+
+        // Chips generate two values per sample (stereo or voice + drum)
+        Int32* segment = buffer + 2 * done;
+        Int32* gen = render(queue->ref, segment, length);
+        if (gen == NULL) {
+            if (active) {
+                memset(segment, 0, 2 * length * sizeof(Int32));
+            }
+        } else {
+            if (!active && done > 0) {
+                memset(buffer, 0, 2 * done * sizeof(Int32));
+            }
+            if (gen != segment) {
+                memcpy(segment, gen, 2 * length * sizeof(Int32));
+            }
+            active = true;
+        }
+        done += length;
+    }
+
+    // Wake a producer waiting for room
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&queue->waiting, 0, __ATOMIC_RELAXED)) {
+        xSemaphoreGive(queue->drained);
+    }
+
+    return active ? buffer : NULL;
+}
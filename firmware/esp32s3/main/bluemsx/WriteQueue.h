@@ -0,0 +1,68 @@
+/*
+  Timestamped register write queue
+
+  Single producer (I/O handling) / single consumer (chip render) ring.
+  Writes are stamped with the mixer sample time and applied at their
+  sample position while the chip renders a mixer block.
+*/
+#pragma once
+
+#include "MsxTypes.h"
+#include "AudioMixer.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WRITE_QUEUE_SIZE 512 // must be a power of 2
+
+// Flags a register read whose side effects (e.g. a memory pointer increment)
+// are replayed in order with the writes, the read value itself was answered
+// on the producer side
+#define WRITE_QUEUE_READ 0x8000
+
+typedef void (*WriteQueueApplyCallback)(void* ref, UInt16 reg, UInt8 value);
+
+typedef struct {
+    UInt32 time;
+    UInt16 reg;
+    UInt8  value;
+} WriteQueueEntry;
+
+typedef struct {
+    Mixer* mixer;
+    WriteQueueApplyCallback applyCallback;
+    void*  ref;
+    UInt32 rdIdx;
+    UInt32 wrIdx;
+    UInt32 waiting;             // producer waits for room, consumer gives drained
+    SemaphoreHandle_t drained;
+    WriteQueueEntry entries[WRITE_QUEUE_SIZE];
+} WriteQueue;
+
+void writeQueueInit(WriteQueue* queue, Mixer* mixer, WriteQueueApplyCallback callback, void* ref);
+void writeQueueDestroy(WriteQueue* queue);
+void writeQueueWrite(WriteQueue* queue, UInt16 reg, UInt8 value);
+void writeQueueFlush(WriteQueue* queue);
+void writeQueueFlushTo(WriteQueue* queue, UInt32 position);
+UInt32 writeQueueLastWrite(WriteQueue* queue, UInt16 reg, UInt16 mask);
+Int32* writeQueueRender(WriteQueue* queue, MixerUpdateCallback render, Int32* buffer, UInt32 count);
+
+// Position after the last queued write, only valid on the producer side
+static inline UInt32 writeQueuePosition(WriteQueue* queue)
+{
+    return queue->wrIdx;
+}
+
+// True once the consumer has applied all writes up to the given position
+static inline bool writeQueueIsApplied(WriteQueue* queue, UInt32 position)
+{
+    return (Int32)(__atomic_load_n(&queue->rdIdx, __ATOMIC_ACQUIRE) - position) >= 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
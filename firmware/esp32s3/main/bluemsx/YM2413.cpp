@@ -30,6 +30,8 @@
 #include <cstring>
 #include "Board.h"
 #include "IoPort.h"
+#include "WriteQueue.h"
+#include "Resampler.h"
 #include <span>
 #include "xrange.hh"
 
@@ -41,12 +43,17 @@ struct YM_2413 {
         address = 0;
     }
     ~YM_2413() {
+        if (resampler) {
+            resamplerDestroy(resampler);
+        }
         delete chip;
     }
 
     Mixer* mixer;
     Int32  handle;
     uint8_t address;
+    WriteQueue queue;
+    Resampler* resampler;
 
     openmsx::YM2413Core* chip;
 };
@@ -63,7 +70,7 @@ bool ym2413IsMuted(YM_2413* ref)
     return ym2413->chip->isMuted();
 }
 
-static Int32* ym2413Sync(void* ref, Int32 *buffer, UInt32 count) 
+static Int32* ym2413Render(void* ref, Int32 *buffer, UInt32 count)
 {
     YM_2413* ym2413 = (YM_2413*)ref;
 
@@ -83,16 +90,35 @@ static Int32* ym2413Sync(void* ref, Int32 *buffer, UInt32 count)
     return buffer;
 }
 
-static void writeAddr(void *ym, UInt16 port, UInt8 data)
+// The core generates at its native rate of FREQUENCY / 72
+static Int32* ym2413Resample(void* ref, Int32 *buffer, UInt32 count)
+{
+    YM_2413* ym2413 = (YM_2413*)ref;
+    return resamplerRender(ym2413->resampler, buffer, count);
+}
+
+static void ym2413Apply(void* ref, UInt16 reg, UInt8 value)
+{
+    YM_2413* ym2413 = (YM_2413*)ref;
+    ym2413->chip->pokeReg((uint8_t)reg, value);
+}
+
+static Int32* ym2413Sync(void* ref, Int32 *buffer, UInt32 count) 
+{
+    YM_2413* ym2413 = (YM_2413*)ref;
+    return writeQueueRender(&ym2413->queue, ym2413->resampler ? ym2413Resample : ym2413Render, buffer, count);
+}
+
+static void writeAddr(void *ym, UInt16 /*port*/, UInt8 data)
 {
     YM_2413* ym2413 = (YM_2413*)ym;
     ym2413->address = data;
 }
 
-static void writeData(void *ym, UInt16 port, UInt8 data)
+static void writeData(void *ym, UInt16 /*port*/, UInt8 data)
 {
     YM_2413* ym2413 = (YM_2413*)ym;
-    ym2413->chip->pokeReg(ym2413->address, data);
+    writeQueueWrite(&ym2413->queue, ym2413->address, data);
 }
 
 YM_2413* ym2413Create(Mixer* mixer)
@@ -102,6 +128,8 @@ YM_2413* ym2413Create(Mixer* mixer)
     ym2413 = new YM_2413;
 
     ym2413->mixer = mixer;
+    writeQueueInit(&ym2413->queue, mixer, ym2413Apply, ym2413);
+    ym2413->resampler = boardGetNativeRate() ? resamplerCreate(FREQUENCY, 72, AUDIO_SAMPLERATE, ym2413Render, ym2413) : NULL;
 
     ym2413->handle = mixerRegisterChannel(mixer, 1, MIXER_CHANNEL_MSXMUSIC_VOICE, MIXER_CHANNEL_MSXMUSIC_DRUM, false, ym2413Sync, ym2413);
 
@@ -116,6 +144,7 @@ void ym2413Destroy(YM_2413* ym2413)
     ioPortUnregister(0x7c);
     ioPortUnregister(0x7d);
     mixerUnregisterChannel(ym2413->mixer, ym2413->handle);
+    writeQueueDestroy(&ym2413->queue);
     delete ym2413;
 }
 
@@ -44,3 +44,14 @@ bool fifo_pop_byte(fifo_t *fifo, uint8_t *bt)
     fifo->rdp = next_rdp;
     return true;
 }
+
+int fifo_count(fifo_t *fifo)
+{
+    int count = fifo->wrp - fifo->rdp;
+    return (count < 0) ? count + fifo->size : count;
+}
+
+void fifo_clear(fifo_t *fifo)
+{
+    fifo->rdp = fifo->wrp;
+}
@@ -21,6 +21,8 @@ typedef struct {
 void fifo_init(fifo_t *fifo, uint8_t *buffer, int size);
 bool fifo_push(fifo_t *fifo, uint8_t *data, int len);
 bool fifo_pop_byte(fifo_t *fifo, uint8_t *bt);
+int fifo_count(fifo_t *fifo);
+void fifo_clear(fifo_t *fifo);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+/*****************************************************************************
+**  Serial console
+**
+**  Copyright (C) 2025 Tim Brugman
+**
+**  This program is free software; you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation; either version 2 of the License, or
+**  (at your option) any later version.
+** 
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program; if not, write to the Free Software
+**  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+******************************************************************************/
+#include "console.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_console.h>
+#include <esp_log.h>
+
+static const char TAG[] = "console";
+
+static fpga_handle_t s_fpga;
+
+static int iolat_cmd(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        fpga_latency_reset(s_fpga);
+        return 0;
+    }
+    if (argc > 1) {
+        printf("usage: iolat [reset]\n");
+        return 1;
+    }
+    fpga_latency_print(s_fpga);
+    return 0;
+}
+
+static int pollwin_cmd(int argc, char** argv)
+{
+    if (argc != 2) {
+        printf("usage: pollwin <us>\n");
+        return 1;
+    }
+    fpga_set_poll_window(s_fpga, strtoul(argv[1], NULL, 0));
+    fpga_latency_reset(s_fpga);
+    return 0;
+}
+
+static int prefetch_cmd(int argc, char** argv)
+{
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        printf("usage: prefetch on|off\n");
+        return 1;
+    }
+    fpga_set_read_prefetch(s_fpga, strcmp(argv[1], "on") == 0);
+    fpga_latency_reset(s_fpga);
+    return 0;
+}
+
+void console_init(fpga_handle_t fpga_handle)
+{
+    esp_console_repl_t* repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+
+    s_fpga = fpga_handle;
+
+    repl_config.prompt = "hfxc>";
+    esp_err_t ret = esp_console_new_repl_uart(&uart_config, &repl_config, &repl);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "No console: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    esp_console_register_help_command();
+
+    const esp_console_cmd_t iolat = {
+        .command = "iolat",
+        .help = "Show the IO request latency histograms, 'reset' clears them",
+        .hint = "[reset]",
+        .func = iolat_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&iolat));
+
+    const esp_console_cmd_t pollwin = {
+        .command = "pollwin",
+        .help = "Set how long to poll for IO after a burst before sleeping, clears the statistics",
+        .hint = "<us>",
+        .func = pollwin_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&pollwin));
+
+    const esp_console_cmd_t prefetch = {
+        .command = "prefetch",
+        .help = "Answer memory data reads from the FPGA read cache or over IPC, clears the statistics",
+        .hint = "on|off",
+        .func = prefetch_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&prefetch));
+
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+}
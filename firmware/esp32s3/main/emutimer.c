@@ -20,23 +20,78 @@
 ******************************************************************************/
 #include "emutimer.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
 
 //static const char TAG[] = "timer";
 
+// The audio clock rate is measured over at least this period (us)
+#define CLOCK_MEASURE_PERIOD    1000000
+// Maximum deviation of the measured rate from the nominal rate (1/256 = 0.4%)
+#define CLOCK_MAX_DEVIATION(r)  ((r) >> 8)
+
 /// Timer data
+///
+/// The sample position runs from the microsecond system timer at a rate that
+/// is measured against the audio clock (frames consumed by the I2S DMA), so it
+/// has sub-sample resolution and does not drift from the audio output.
 struct emutimer_t {
     uint32_t frequency;
-    uint32_t prev_tick;
-    uint32_t remainder;
+    uint64_t rate_nominal;      ///< samples per us, 32.32 fixed point
+    uint64_t rate;              ///< measured samples per us, 32.32 fixed point
+    int64_t base_time;          ///< system time (us) of base_position
+    uint64_t base_position;     ///< sample position, 32.32 fixed point
+    uint32_t consumed;          ///< sample position handed out by timer_get_duration
+    int64_t clock_time;         ///< system time (us) of last audio clock event
+    uint32_t clock_frames;      ///< frames consumed by the audio clock
+    int64_t clock_ref_time;     ///< start of the current rate measurement
+    uint32_t clock_ref_frames;
+    portMUX_TYPE lock;
 };
 typedef struct emutimer_t emutimer_t;
 
+static inline uint64_t IRAM_ATTR timer_position(emutimer_t *timer, int64_t now)
+{
+    return timer->base_position + (uint64_t)(now - timer->base_time) * timer->rate;
+}
+
+static void IRAM_ATTR timer_update_rate(emutimer_t *timer)
+{
+    if (timer->clock_time == 0) {
+        // No audio clock events (yet), keep running at the nominal rate
+        return;
+    }
+    if (timer->clock_ref_time == 0) {
+        timer->clock_ref_time = timer->clock_time;
+        timer->clock_ref_frames = timer->clock_frames;
+        return;
+    }
+    int64_t period = timer->clock_time - timer->clock_ref_time;
+    if (period < CLOCK_MEASURE_PERIOD) {
+        return;
+    }
+    uint64_t rate = ((uint64_t)(timer->clock_frames - timer->clock_ref_frames) << 32) / period;
+    if (rate > timer->rate_nominal + CLOCK_MAX_DEVIATION(timer->rate_nominal)) {
+        rate = timer->rate_nominal + CLOCK_MAX_DEVIATION(timer->rate_nominal);
+    }
+    if (rate < timer->rate_nominal - CLOCK_MAX_DEVIATION(timer->rate_nominal)) {
+        rate = timer->rate_nominal - CLOCK_MAX_DEVIATION(timer->rate_nominal);
+    }
+    timer->rate = rate;
+    timer->clock_ref_time = timer->clock_time;
+    timer->clock_ref_frames = timer->clock_frames;
+}
+
 emutimer_handle_t timer_create(uint32_t frequency)
 {
-    emutimer_t *timer = (emutimer_t *)malloc(sizeof(emutimer_t));
+    emutimer_t *timer = (emutimer_t *)calloc(1, sizeof(emutimer_t));
     timer->frequency = frequency;
+    timer->rate_nominal = ((uint64_t)frequency << 32) / 1000000;
+    timer->rate = timer->rate_nominal;
+    portMUX_INITIALIZE(&timer->lock);
     timer_reset(timer);
     return timer;
 }
@@ -48,15 +103,50 @@ void timer_destroy(emutimer_handle_t timer)
 
 void timer_reset(emutimer_handle_t timer)
 {
-    timer->prev_tick = xTaskGetTickCount();
-    timer->remainder = 0;
+    // Drop pending samples, the position stays monotonic
+    portENTER_CRITICAL(&timer->lock);
+    timer->base_time = esp_timer_get_time();
+    timer->base_position = (uint64_t)timer->consumed << 32;
+    portEXIT_CRITICAL(&timer->lock);
 }
 
-uint32_t timer_get_duration(emutimer_handle_t timer)
+void IRAM_ATTR timer_clock_event(emutimer_handle_t timer, uint32_t frames)
 {
-    uint32_t cur_tick = xTaskGetTickCount();
-    uint32_t count = pdTICKS_TO_MS((cur_tick - timer->prev_tick) * timer->frequency) + timer->remainder;
-    timer->prev_tick = cur_tick;
-    timer->remainder = count % 1000;
-    return count /= 1000;
+    portENTER_CRITICAL_ISR(&timer->lock);
+    timer->clock_time = esp_timer_get_time();
+    timer->clock_frames += frames;
+    portEXIT_CRITICAL_ISR(&timer->lock);
+}
+
+uint32_t IRAM_ATTR timer_get_position(emutimer_handle_t timer)
+{
+    portENTER_CRITICAL(&timer->lock);
+    uint64_t position = timer_position(timer, esp_timer_get_time());
+    portEXIT_CRITICAL(&timer->lock);
+    return (uint32_t)(position >> 32);
+}
+
+uint32_t IRAM_ATTR timer_get_pending(emutimer_handle_t timer)
+{
+    portENTER_CRITICAL(&timer->lock);
+    uint64_t position = timer_position(timer, esp_timer_get_time());
+    uint32_t count = (uint32_t)(position >> 32) - timer->consumed;
+    portEXIT_CRITICAL(&timer->lock);
+    return count;
+}
+
+uint32_t IRAM_ATTR timer_get_duration(emutimer_handle_t timer)
+{
+    portENTER_CRITICAL(&timer->lock);
+    int64_t now = esp_timer_get_time();
+    uint64_t position = timer_position(timer, now);
+    uint32_t count = (uint32_t)(position >> 32) - timer->consumed;
+    timer->consumed += count;
+    // Rebase, so the rate can change without moving the position
+    timer->base_time = now;
+    timer->base_position = position;
+    timer_update_rate(timer);
+    portEXIT_CRITICAL(&timer->lock);
+
+    return count;
 }
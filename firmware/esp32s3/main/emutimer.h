@@ -33,6 +33,15 @@ emutimer_handle_t timer_create(uint32_t frequency);
 void timer_destroy(emutimer_handle_t timer);
 
 void timer_reset(emutimer_handle_t timer);
+
+// Audio clock reference, frames consumed by the audio output (ISR safe)
+void timer_clock_event(emutimer_handle_t timer, uint32_t frames);
+
+// Current sample position on the emulation timeline
+uint32_t timer_get_position(emutimer_handle_t timer);
+// Samples elapsed since the last timer_get_duration, without consuming them
+uint32_t timer_get_pending(emutimer_handle_t timer);
+// Samples elapsed since the last call
 uint32_t timer_get_duration(emutimer_handle_t timer);
 
 #ifdef __cplusplus
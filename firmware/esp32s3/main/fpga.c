@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <freertos/FreeRTOS.h>
@@ -30,18 +31,45 @@
 #include <driver/gpio.h>
 #include <sdkconfig.h>
 #include <esp_log.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <nvs.h>
 
 #include "llspi.h"
 #include "i2s.h"
 #include "emutimer.h"
 
 #define MAX(a, b)   (((a) > (b)) ? (a) : (b))
+#define MIN(a, b)   (((a) < (b)) ? (a) : (b))
 
 #define FPGA_BUSY_TIMEOUT_MS  100
 
+// After a burst of IO keep polling the IRQ line this long before sleeping
+// on the interrupt again, 0 to always sleep. Tune with the console.
+#define FPGA_POLL_WINDOW_US   100
+
+// Polling time allowed per RTOS tick. The FPGA task shares core 1 and its
+// priority with a mixer worker, past this it sleeps on the interrupt until
+// the next tick. Also the longest poll window accepted.
+#define FPGA_POLL_BUDGET_US   250
+
 #define FPGA_CLK_FREQ         (20*1000*1000)
 #define FPGA_INPUT_DELAY_NS   0
 
+// Link timing calibration, tried fastest first. The input delay also makes
+// the driver insert dummy clocks before reads once it exceeds half a clock.
+#define FPGA_CAL_DELAY_STEP_NS  5
+#define FPGA_CAL_DELAY_STEPS    8   // 0 .. 35 ns
+#define FPGA_CAL_MIN_WINDOW     3   // passing delay steps needed, the middle one is used
+#define FPGA_NVS_NAMESPACE      "fpga"
+
+static const int s_cal_clk_freqs[] = { 40*1000*1000, 80*1000*1000/3, FPGA_CLK_FREQ };
+
+// Keep the next value of sequentially read ports (memory data) in the FPGA
+// read cache, 0 to read every value over IPC. Switch with the console to
+// compare.
+#define FPGA_READ_PREFETCH    1
+
 #define SPI_HOST              SPI2_HOST
 #define SPI_PIN_NUM_CS        4
 #define SPI_PIN_NUM_CLK       5
@@ -53,6 +81,70 @@
 
 static const char TAG[] = "main";
 
+#define FPGA_CMD_LOOPBACK       0
+#define FPGA_CMD_UPDATE         1
+#define FPGA_CMD_SET_PROPERTIES 2
+#define FPGA_CMD_SET_IRQ        3   // addr 0: slot IRQ, addr 1: ADPCM FIFO credits, addr 2: clear ADPCM FIFO credits
+#define FPGA_CMD_SET_PROPERTIES_BULK 4 // start port + one properties nibble per port
+#define FPGA_CMD_GET_RESPONSE   8
+#define FPGA_CMD_GET_RESPONSES  9   // count header + as many responses as clocked
+#define FPGA_CMD_REPLY_GET_RESPONSES 11 // update (read reply), then as GET_RESPONSES
+#define FPGA_CMD_SYNC_PROPERTIES 0x10 // driver internal: send changed properties, data 1: also prefetch ports
+
+// Commands posted to the FPGA task, must be a power of 2
+#define FPGA_CMD_QUEUE_SIZE     64
+
+// Responses per batched read, 1 count byte + 21 * 3 bytes fill 64 bytes
+#define FPGA_BATCH_MAX          21
+#define FPGA_BATCH_WORDS        ((1 + 3 * FPGA_BATCH_MAX + 3) / 4)
+
+// Ports per bulk properties transfer, half the FPGA command fifo
+#define FPGA_BULK_MAX           128
+#define FPGA_BULK_WORDS         ((1 + FPGA_BULK_MAX / 2 + 3) / 4)
+
+// Latency histograms, bucket n counts up to 2^n << FPGA_HIST_SHIFT cycles
+// (0.53 us at 240 MHz), the last one everything above
+#define FPGA_HIST_SHIFT         7
+#define FPGA_HIST_BUCKETS       14
+
+#define FPGA_RESP_RESET         1
+#define FPGA_RESP_LOOPBACK      2
+#define FPGA_RESP_NOTIFY        4
+#define FPGA_RESP_WRITE         5
+#define FPGA_RESP_READ          6
+
+/// Latency histogram in CPU cycles
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[FPGA_HIST_BUCKETS];
+} fpga_hist_t;
+
+/// IO handling latency, the stages of a read add up to its total
+typedef struct {
+    fpga_hist_t wake;           ///< IRQ (ISR entry) to handler task running
+    fpga_hist_t fetch;          ///< Response read started to responses in memory
+    fpga_hist_t read_handler;   ///< ioPortReadPort()
+    fpga_hist_t read_reply;     ///< Reply to the FPGA (UPDATE) started
+    fpga_hist_t read_total;     ///< IRQ or response read started to reply started
+    fpga_hist_t write_handler;  ///< ioPortWritePort()
+    fpga_hist_t write_total;    ///< IRQ or response read started to write handled
+    fpga_hist_t notify;         ///< Read answered from the FPGA read cache, side effects and next value sent
+    uint32_t irq_wakes;         ///< Bursts started by the interrupt
+    uint32_t poll_hits;         ///< Bursts found while polling
+    uint32_t poll_misses;       ///< Poll windows that ended without one
+    uint32_t poll_capped;       ///< Poll windows cut short by the per tick budget
+    uint64_t poll_cycles;       ///< Time spent polling
+    uint32_t responses;         ///< Responses handled
+} fpga_latency_t;
+
+/// Command queue slot, seq tells whether it is free or filled for a lap
+typedef struct {
+    uint32_t seq;
+    uint32_t cmd;               ///< command << 16 | addr << 8 | data
+} fpga_cmd_slot_t;
+
 /// Configurations of the spi_fpga
 typedef struct {
     spi_host_device_t host;     ///< The SPI host used, set before calling `fpga_create()`
@@ -63,31 +155,36 @@ typedef struct {
 struct fpga_context_t {
     fpga_config_t cfg;          ///< Configuration by the caller.
     spi_device_handle_t spi;    ///< SPI device handle
+    int clock_hz;               ///< SPI clock in use
+    int input_delay_ns;         ///< Input delay in use
     reset_callback_t reset_callback;
     void* reset_callback_ref;
-    SemaphoreHandle_t spi_sem;  ///< Semaphore for SPI transfers
-    SemaphoreHandle_t interrupt_sem; ///< Semaphore for ready signal
+    TaskHandle_t task;          ///< FPGA task, owns the SPI bus once started
+    volatile bool irq_flag;     ///< Set by the ISR, the FPGA has responses
+    uint32_t poll_window_us;    ///< IRQ line polling after a burst
+    TickType_t poll_tick;       ///< Tick the polling budget is for
+    uint32_t poll_budget;       ///< Polling cycles left in that tick
+    bool read_prefetch;         ///< Prefetch ports are read from the FPGA read cache
+    uint32_t cmd_head;          ///< Command queue, next slot to claim by a poster
+    uint32_t cmd_tail;          ///< Command queue, next slot for the FPGA task
+    fpga_cmd_slot_t cmd_queue[FPGA_CMD_QUEUE_SIZE];
     spi_transaction_ext_t read_fifo_trans;
     spi_transaction_ext_t write_fifo_trans;
+    spi_transaction_ext_t read_batch_trans[2];  ///< Double buffered, one is decoded while the next is read
+    uint32_t read_batch_buf[2][FPGA_BATCH_WORDS];
+    uint32_t read_batch_slots[2];
     bool read_fifo_busy;
-    uint32_t read_fifo_value;
+    spi_transaction_ext_t bulk_trans;
+    uint32_t bulk_buf[FPGA_BULK_WORDS];
+    bool io_deferred;           ///< Property changes are collected until fpga_io_commit()
+    uint32_t irq_cycles;        ///< Cycle count at the last IRQ
+    uint32_t batch_cycles[2];   ///< Cycle count at the start of the batched reads
+    fpga_latency_t latency;
 };
 
 typedef struct fpga_context_t fpga_context_t;
 typedef struct fpga_context_t* fpga_handle_t;
 
-#define FPGA_CMD_LOOPBACK       0
-#define FPGA_CMD_UPDATE         1
-#define FPGA_CMD_SET_PROPERTIES 2
-#define FPGA_CMD_SET_IRQ        3
-#define FPGA_CMD_GET_RESPONSE   8
-
-#define FPGA_RESP_RESET         1
-#define FPGA_RESP_LOOPBACK      2
-#define FPGA_RESP_NOTIFY        4
-#define FPGA_RESP_WRITE         5
-#define FPGA_RESP_READ          6
-
 typedef struct {
     union {
         struct {
@@ -115,13 +212,250 @@ typedef struct {
 } fpga_response_t;
 
 static fpga_io_properties_t s_io_properties[256];
+static fpga_io_properties_t s_io_properties_fpga[256];  ///< As last sent to the FPGA
+static bool s_io_prefetch[256];                         ///< Registered with IoPropPrefetch
 
 static void isr_handler(void* arg);
 
 esp_err_t spi_fast_fpga_write(fpga_context_t* ctx, uint8_t cmd, uint8_t addr, uint8_t data);
+static esp_err_t spi_fpga_write_direct(fpga_context_t* ctx, uint8_t cmd, uint8_t addr, uint8_t data);
+static void spi_fpga_finish_read(fpga_context_t* ctx);
 esp_err_t spi_fpga_read(fpga_context_t* ctx, uint32_t* out_data);
 static void fpga_handle_communication(void *args);
 
+// Attach the FPGA to the SPI bus with the given timing, replacing an earlier attach
+static esp_err_t fpga_spi_attach(fpga_context_t* ctx, int clock_hz, int input_delay_ns)
+{
+    esp_err_t ret;
+
+    if (ctx->spi != NULL) {
+        spi_device_release_bus(ctx->spi);
+        ret = spi_bus_remove_device(ctx->spi);
+        ESP_ERROR_CHECK(ret);
+        ctx->spi = NULL;
+    }
+
+    spi_device_interface_config_t devcfg = {
+        .command_bits = 4,
+        .address_bits = 0,
+        .dummy_bits = 0, // don't use dummy bits here as they will also be inserted in write transactions, use SPI_TRANS_VARIABLE_DUMMY instead
+        .clock_speed_hz = clock_hz,
+        .mode = 0,          //SPI mode 0
+        .spics_io_num = SPI_PIN_NUM_CS,
+        .queue_size = 1,
+        .flags = SPI_DEVICE_HALFDUPLEX,
+        .input_delay_ns = input_delay_ns,
+    };
+    ret = spi_bus_add_device(ctx->cfg.host, &devcfg, &ctx->spi);
+    if (ret != ESP_OK) {
+        ctx->spi = NULL;
+        return ret;
+    }
+
+    // Acquire the SPI bus permanently
+    ret = spi_device_acquire_bus(ctx->spi, portMAX_DELAY);
+    ESP_ERROR_CHECK(ret);
+
+    // Setup the low-latency SPI driver
+    llspi_setup_device(ctx->spi);
+
+    ctx->clock_hz = clock_hz;
+    ctx->input_delay_ns = input_delay_ns;
+    return ESP_OK;
+}
+
+// Read responses until the fifo is empty, bounded as a bad timing can make
+// garbage look valid
+static void fpga_flush_responses(fpga_context_t* ctx)
+{
+    uint32_t rxvalue;
+    for (int i = 0; i <= 256; i++) {
+        esp_err_t ret = spi_fpga_read(ctx, &rxvalue);
+        ESP_ERROR_CHECK(ret);
+        if ((rxvalue & 0xF00000) != 0x800000) {
+            break;
+        }
+    }
+}
+
+static uint8_t fpga_loopback_pattern(int pass, int addr)
+{
+    switch (pass) {
+    case 0:  return 1 << (addr & 7);
+    case 1:  return ~(1 << (addr & 7));
+    case 2:  return (addr & 1) ? 0x55 : 0xaa;
+    default: return addr;
+    }
+}
+
+// Echo test patterns through the FPGA, this exercises both directions
+static bool fpga_loopback_test(fpga_context_t* ctx, bool verbose)
+{
+    esp_err_t ret;
+    uint32_t rxvalue;
+
+    fpga_flush_responses(ctx);
+    for (int pass = 0; pass < 4; pass++) {
+        for (int addr = 0; addr <= 0xff; addr++) {
+            uint8_t data = fpga_loopback_pattern(pass, addr);
+            // Loopback command to FPGA
+            ret = spi_fast_fpga_write(ctx, FPGA_CMD_LOOPBACK, (uint8_t)addr, data);
+            ESP_ERROR_CHECK(ret);
+            // Get response
+            ret = spi_fpga_read(ctx, &rxvalue);
+            ESP_ERROR_CHECK(ret);
+            uint32_t expected = (8 << 20) | (FPGA_RESP_LOOPBACK << 16) | (data << 8) | addr;
+            if (rxvalue != expected) {
+                if (verbose) {
+                    ESP_LOGE(TAG, "Loopback test failed at addr 0x%x: expected 0x%x, got 0x%x", addr, expected, rxvalue);
+                }
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Sweep clock and input delay, take the fastest clock with a passing delay
+// window of FPGA_CAL_MIN_WINDOW steps and use the middle of the window
+static bool fpga_calibrate(fpga_context_t* ctx, int* clock_hz, int* input_delay_ns)
+{
+    ESP_LOGI(TAG, "Calibrating SPI timing ...");
+    for (int i = 0; i < (int)(sizeof(s_cal_clk_freqs) / sizeof(s_cal_clk_freqs[0])); i++) {
+        int best_start = 0, best_len = 0, len = 0;
+        for (int step = 0; step < FPGA_CAL_DELAY_STEPS; step++) {
+            bool pass = fpga_spi_attach(ctx, s_cal_clk_freqs[i], step * FPGA_CAL_DELAY_STEP_NS) == ESP_OK &&
+                        fpga_loopback_test(ctx, false);
+            len = pass ? len + 1 : 0;
+            if (len > best_len) {
+                best_len = len;
+                best_start = step + 1 - len;
+            }
+        }
+        ESP_LOGI(TAG, "%d Hz: %d of %d delays pass", s_cal_clk_freqs[i], best_len, FPGA_CAL_DELAY_STEPS);
+        if (best_len >= FPGA_CAL_MIN_WINDOW) {
+            *clock_hz = s_cal_clk_freqs[i];
+            *input_delay_ns = (best_start + best_len / 2) * FPGA_CAL_DELAY_STEP_NS;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool fpga_timing_load(int* clock_hz, int* input_delay_ns)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(FPGA_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    int32_t clk, delay;
+    bool ok = nvs_get_i32(nvs, "spi_clk", &clk) == ESP_OK &&
+              nvs_get_i32(nvs, "spi_delay", &delay) == ESP_OK;
+    nvs_close(nvs);
+    if (ok) {
+        *clock_hz = clk;
+        *input_delay_ns = delay;
+    }
+    return ok;
+}
+
+static void fpga_timing_store(int clock_hz, int input_delay_ns)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(FPGA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_set_i32(nvs, "spi_clk", clock_hz);
+        if (ret == ESP_OK) {
+            ret = nvs_set_i32(nvs, "spi_delay", input_delay_ns);
+        }
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Storing SPI timing failed: %s", esp_err_to_name(ret));
+    }
+}
+
+static void fpga_timing_erase(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(FPGA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_erase_key(nvs, "spi_clk");
+        if (ret == ESP_OK || ret == ESP_ERR_NVS_NOT_FOUND) {
+            ret = nvs_erase_key(nvs, "spi_delay");
+        }
+        if (ret == ESP_OK || ret == ESP_ERR_NVS_NOT_FOUND) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Erasing SPI timing failed: %s", esp_err_to_name(ret));
+    }
+}
+
+// Send the properties of ports first .. last-1 in one bulk transfer
+static void fpga_io_upload(fpga_context_t* ctx, int first, int last)
+{
+    uint8_t* buf = (uint8_t*)ctx->bulk_buf;
+    int count = last - first;
+
+    assert(count > 0 && count <= FPGA_BULK_MAX && last <= 0xff);
+
+    // Start port, then one nibble per port, high nibble first
+    memset(buf, 0, sizeof(ctx->bulk_buf));
+    buf[0] = first;
+    for (int i = 0; i < count; i++) {
+        uint8_t val = s_io_properties[first + i].val & 0x0f;
+        buf[1 + i / 2] |= (i & 1) ? val : val << 4;
+        s_io_properties_fpga[first + i] = s_io_properties[first + i];
+    }
+    ctx->bulk_trans.base.length = 8 + 4 * count;
+
+    // Longer than the low-latency driver handles, use the DMA transfer
+    spi_fpga_finish_read(ctx);
+    esp_err_t ret = spi_device_polling_transmit(ctx->spi, &ctx->bulk_trans.base);
+    ESP_ERROR_CHECK(ret);
+}
+
+// Send the properties that differ from what the FPGA holds. A single port
+// goes as a normal write, a range (with small gaps) as one bulk transfer.
+// With clear_prefetch set prefetch ports are sent anyway, writing their
+// properties ends a prefetch. Bus owner only, others post
+// FPGA_CMD_SYNC_PROPERTIES.
+static void fpga_io_sync(fpga_context_t* ctx, bool clear_prefetch)
+{
+    int first = -1, last = -1;
+
+    for (int port = 0; port <= 0xff; port++) {
+        bool changed = port < 0xff &&
+                       (s_io_properties[port].val != s_io_properties_fpga[port].val ||
+                        (clear_prefetch && s_io_properties[port].read_mode == 2));
+        if (changed && first >= 0 && port - first < FPGA_BULK_MAX && port - last <= 8) {
+            // extend the range
+            last = port;
+            continue;
+        }
+        if (first >= 0 && (changed || port == 0xff || port - last > 8)) {
+            // send the range
+            if (first == last) {
+                esp_err_t ret = spi_fpga_write_direct(ctx, FPGA_CMD_SET_PROPERTIES, first, s_io_properties[first].val);
+                ESP_ERROR_CHECK(ret);
+                s_io_properties_fpga[first] = s_io_properties[first];
+            } else {
+                fpga_io_upload(ctx, first, last + 1);
+            }
+            first = -1;
+        }
+        if (changed) {
+            first = last = port;
+        }
+    }
+}
+
 void fpga_set_reset_callback(fpga_handle_t ctx, reset_callback_t reset_callback, void* ref)
 {
     ctx->reset_callback = reset_callback;
@@ -158,28 +492,15 @@ fpga_handle_t fpga_create(void)
     ctx->cfg.host = SPI_HOST;
     ctx->cfg.irq_io = SPI_PIN_NUM_IRQ;
 
-    gpio_install_isr_service(0);
-
     ESP_LOGI(TAG, "Initializing device...");
 
-    // Attach the FPGA to the SPI bus
-    static spi_device_interface_config_t devcfg = {
-        .command_bits = 4,
-        .address_bits = 0,
-        .dummy_bits = 0, // don't use dummy bits here as they will also be inserted in write transactions, use SPI_TRANS_VARIABLE_DUMMY instead
-        .clock_speed_hz = FPGA_CLK_FREQ,
-        .mode = 0,          //SPI mode 0
-        .spics_io_num = SPI_PIN_NUM_CS,
-        .queue_size = 1,
-        .flags = SPI_DEVICE_HALFDUPLEX,
-        .input_delay_ns = FPGA_INPUT_DELAY_NS,
-    };
-    ret = spi_bus_add_device(ctx->cfg.host, &devcfg, &ctx->spi);
+    // Attach the FPGA to the SPI bus at the safe default timing
+    ret = fpga_spi_attach(ctx, FPGA_CLK_FREQ, FPGA_INPUT_DELAY_NS);
     ESP_ERROR_CHECK(ret);
 
-    // Semaphore for IST
-    ctx->interrupt_sem = xSemaphoreCreateBinary();
-    ESP_ERROR_CHECK(ret);
+    ctx->poll_window_us = FPGA_POLL_WINDOW_US;
+    ctx->read_prefetch = FPGA_READ_PREFETCH;
+    ctx->poll_budget = FPGA_POLL_BUDGET_US * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
 
     // Setup transfer structs
     ctx->read_fifo_trans.base.user = ctx;
@@ -188,75 +509,107 @@ fpga_handle_t fpga_create(void)
     ctx->read_fifo_trans.base.flags = SPI_TRANS_USE_RXDATA | (SPI_TRANS_MULTILINE_CMD | SPI_TRANS_MULTILINE_ADDR | SPI_TRANS_VARIABLE_DUMMY | SPI_TRANS_MODE_QIO);
     ctx->read_fifo_trans.dummy_bits = 2;    // this turns out to be 'clocks', not 'bits'
 
+    for (int i = 0; i < 2; i++) {
+        ctx->read_batch_trans[i].base.user = ctx;
+        ctx->read_batch_trans[i].base.cmd = FPGA_CMD_GET_RESPONSES;
+        ctx->read_batch_trans[i].base.rx_buffer = ctx->read_batch_buf[i];
+        ctx->read_batch_trans[i].base.flags = SPI_TRANS_MULTILINE_CMD | SPI_TRANS_MULTILINE_ADDR | SPI_TRANS_VARIABLE_ADDR | SPI_TRANS_VARIABLE_DUMMY | SPI_TRANS_MODE_QIO;
+    }
+
     ctx->write_fifo_trans.base.user = ctx;
     ctx->write_fifo_trans.base.tx_data[2] = 0xff; // dummy clocks
     ctx->write_fifo_trans.base.length = 16+8; // +8 for two dummy clocks after the data
     ctx->write_fifo_trans.base.flags = SPI_TRANS_USE_TXDATA | (SPI_TRANS_MULTILINE_CMD | SPI_TRANS_MULTILINE_ADDR | SPI_TRANS_VARIABLE_DUMMY | SPI_TRANS_MODE_QIO);
 
-    // Acquire the SPI bus permanently
-    ret = spi_device_acquire_bus(ctx->spi, portMAX_DELAY);
-    ESP_ERROR_CHECK(ret);
+    ctx->bulk_trans.base.user = ctx;
+    ctx->bulk_trans.base.cmd = FPGA_CMD_SET_PROPERTIES_BULK;
+    ctx->bulk_trans.base.tx_buffer = ctx->bulk_buf;
+    ctx->bulk_trans.base.flags = SPI_TRANS_MULTILINE_CMD | SPI_TRANS_MULTILINE_ADDR | SPI_TRANS_VARIABLE_DUMMY | SPI_TRANS_MODE_QIO;
 
-    // Setup the low-latency SPI driver
-    llspi_setup_device(ctx->spi);
-
-    // Mutex for SPI communication
-    ctx->spi_sem = xSemaphoreCreateBinary();
-    assert(ctx->spi_sem != NULL);
-    xSemaphoreGive(ctx->spi_sem);
-
-    // Init FPGA IO bridge
-    // -------------------
+    // Command queue, slot i is free for lap 0
+    for (int i = 0; i < FPGA_CMD_QUEUE_SIZE; i++) {
+        ctx->cmd_queue[i].seq = i;
+    }
 
-    // Global disable
+    // Global disable, keeps MSX IO out of the fifo during the timing tests
     ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, 0xff, 0);
     ESP_ERROR_CHECK(ret);
 
-    // Disable all IO properties
-    for (uint8_t addr = 0; addr < 0xff; addr++) {
-        ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, addr, 0);
+    ESP_LOGI(TAG, "Flushing fifo ...");
+    fpga_flush_responses(ctx);
+
+    // Link timing, the stored calibration or a new one
+    int clock_hz, input_delay_ns;
+    bool timing_ok = false;
+    if (fpga_timing_load(&clock_hz, &input_delay_ns)) {
+        timing_ok = fpga_spi_attach(ctx, clock_hz, input_delay_ns) == ESP_OK && fpga_loopback_test(ctx, false);
+        if (!timing_ok) {
+            ESP_LOGW(TAG, "Stored SPI timing %d Hz, %d ns failed, recalibrating", clock_hz, input_delay_ns);
+        }
+    }
+    if (!timing_ok && fpga_calibrate(ctx, &clock_hz, &input_delay_ns)) {
+        fpga_timing_store(clock_hz, input_delay_ns);
+        timing_ok = fpga_spi_attach(ctx, clock_hz, input_delay_ns) == ESP_OK;
+    }
+    if (!timing_ok) {
+        ESP_LOGW(TAG, "SPI calibration failed, using %d Hz", FPGA_CLK_FREQ);
+        ret = fpga_spi_attach(ctx, FPGA_CLK_FREQ, FPGA_INPUT_DELAY_NS);
         ESP_ERROR_CHECK(ret);
     }
 
-    ESP_LOGI(TAG, "Flushing fifo ...");
-    uint32_t rxvalue;
-    for(;;) {
-        ret = spi_fpga_read(ctx, &rxvalue);
+    for (;;) {
+        // Init FPGA IO bridge
+        // -------------------
+
+        // Global disable
+        ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, 0xff, 0);
         ESP_ERROR_CHECK(ret);
-        if ((rxvalue & 0xF00000) != 0x800000) {
-            break;
+
+        // Disable all IO properties
+        memset(s_io_properties, 0, sizeof(s_io_properties));
+        memset(s_io_properties_fpga, 0, sizeof(s_io_properties_fpga));
+        memset(s_io_prefetch, 0, sizeof(s_io_prefetch));
+        for (int addr = 0; addr < 0xff; addr += FPGA_BULK_MAX) {
+            fpga_io_upload(ctx, addr, MIN(addr + FPGA_BULK_MAX, 0xff));
         }
-    }
+        ctx->io_deferred = true;
 
-    // Loopback test
-    ESP_LOGI(TAG, "Loopback test ...");
-    for (int addr = 0; addr <= 0xff; addr++) {
-        // Loopback command to FPGA
-        ret = spi_fast_fpga_write(ctx, FPGA_CMD_LOOPBACK, (uint8_t)addr, 1 << (addr & 7));
+        // A sweep may have garbled commands, start from a clear slot IRQ and no ADPCM FIFO credits
+        ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_IRQ, 0, 0);
         ESP_ERROR_CHECK(ret);
-        // Get response
-        ret = spi_fpga_read(ctx, &rxvalue);
+        ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_IRQ, 2, 0);
         ESP_ERROR_CHECK(ret);
-        uint32_t expected = (8 << 20) | (FPGA_RESP_LOOPBACK << 16) | (0x100 << (addr & 7)) | addr;
-        if (rxvalue != expected) {
-            ESP_LOGE(TAG, "Loopback test failed at addr 0x%x: expected 0x%x, got 0x%x", addr, expected, rxvalue);
+
+        // Loopback test
+        ESP_LOGI(TAG, "Loopback test at %d Hz, input delay %d ns ...", ctx->clock_hz, ctx->input_delay_ns);
+        if (fpga_loopback_test(ctx, true)) {
+            break;
+        }
+        if (ctx->clock_hz == FPGA_CLK_FREQ && ctx->input_delay_ns == FPGA_INPUT_DELAY_NS) {
+            spi_device_release_bus(ctx->spi);
+            spi_bus_remove_device(ctx->spi);
+            spi_bus_free(ctx->cfg.host);
+            free(ctx);
             return NULL;
         }
+
+        // The stored or calibrated timing is marginal, drop it and redo the
+        // init at the default timing, it is calibrated again on the next boot
+        ESP_LOGW(TAG, "Loopback test failed, falling back to %d Hz", FPGA_CLK_FREQ);
+        fpga_timing_erase();
+        ret = fpga_spi_attach(ctx, FPGA_CLK_FREQ, FPGA_INPUT_DELAY_NS);
+        ESP_ERROR_CHECK(ret);
     }
     ESP_LOGI(TAG, "passed");
 
     // Final read to reset the IRQ
+    uint32_t rxvalue;
     ret = spi_fpga_read(ctx, &rxvalue);
     ESP_ERROR_CHECK(ret);
 
-    // Arm interrupt
-    xSemaphoreTake(ctx->interrupt_sem, 0);
-    gpio_set_intr_type(ctx->cfg.irq_io, GPIO_INTR_HIGH_LEVEL);
-    ret = gpio_isr_handler_add(ctx->cfg.irq_io, isr_handler, ctx);
-    ESP_ERROR_CHECK(ret);
-
-    // Start interrupt handler task
-    xTaskCreatePinnedToCore(fpga_handle_communication, "fpga_handle_communication", 4096, ctx, 5, NULL, 1);
+    // Start interrupt handler task, it arms the interrupt and from here on
+    // owns the SPI bus
+    xTaskCreatePinnedToCore(fpga_handle_communication, "fpga_handle_communication", 4096, ctx, 5, &ctx->task, 1);
 
     return ctx;
 }
@@ -268,48 +621,64 @@ void fpga_io_start(fpga_handle_t ctx)
 
 void fpga_io_stop(fpga_handle_t ctx)
 {
-    // Global disable
+    // Global disable, property changes wait for the next commit
     esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, 0xff, 0);
     ESP_ERROR_CHECK(ret);
+    ctx->io_deferred = true;
     gpio_intr_disable(ctx->cfg.irq_io);
 }
 
 void fpga_io_reset(fpga_handle_t ctx)
 {
-    // Disable all IO properties
-    for (uint8_t addr = 0; addr < 0xff; addr++) {
-        esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, addr, 0);
-        ESP_ERROR_CHECK(ret);
-    }
+    // Disable all IO properties, sent with the registrations on commit
+    memset(s_io_properties, 0, sizeof(s_io_properties));
+    memset(s_io_prefetch, 0, sizeof(s_io_prefetch));
+    ctx->io_deferred = true;
+}
 
-    // Global enable
-    esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, 0xff, 0x55);
+void fpga_io_commit(fpga_handle_t ctx)
+{
+    // Prefetch ports are always sent, this drops a value cached before the reset
+    esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SYNC_PROPERTIES, 0, 1);
     ESP_ERROR_CHECK(ret);
 
-    memset(s_io_properties, 0, sizeof(s_io_properties));
+    // Global enable
+    ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, 0xff, 0x55);
+    ESP_ERROR_CHECK(ret);
+    ctx->io_deferred = false;
 }
 
 void fpga_io_register(fpga_handle_t ctx, uint8_t port, IoPortProperties_t prop)
 {
     if (prop & IoPropRead) {
         ESP_LOGI(TAG, "Register read port 0x%02x", port);
-        s_io_properties[port].read_mode = 3; // Read via IPC
+        s_io_prefetch[port] = (prop & IoPropPrefetch) != 0;
+        if (ctx->read_prefetch && s_io_prefetch[port]) {
+            s_io_properties[port].read_mode = 2; // Read from cache + notify, via IPC when not prefetched
+        } else {
+            s_io_properties[port].read_mode = 3; // Read via IPC
+        }
     }
     if (prop & IoPropWrite) {
         ESP_LOGI(TAG, "Register write port 0x%02x", port);
         s_io_properties[port].write_ipc = 1; // Write via IPC
     }
-    esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, port, s_io_properties[port].val);
-    ESP_ERROR_CHECK(ret);
+    if (!ctx->io_deferred) {
+        esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SYNC_PROPERTIES, 0, 0);
+        ESP_ERROR_CHECK(ret);
+    }
 }
 
 void fpga_io_unregister(fpga_handle_t ctx, uint8_t port)
 {
     ESP_LOGI(TAG, "Unregister port 0x%02x", port);
     s_io_properties[port].val = 0;
+    s_io_prefetch[port] = false;
 
-    esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SET_PROPERTIES, port, 0);
-    ESP_ERROR_CHECK(ret);
+    if (!ctx->io_deferred) {
+        esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SYNC_PROPERTIES, 0, 0);
+        ESP_ERROR_CHECK(ret);
+    }
 }
 
 void fpga_irq_set(fpga_handle_t fpga_handle)
@@ -324,26 +693,261 @@ void fpga_irq_reset(fpga_handle_t fpga_handle)
     ESP_ERROR_CHECK(ret);
 }
 
+void fpga_adpcm_credit(fpga_handle_t fpga_handle, uint32_t count)
+{
+    while (count > 0) {
+        uint8_t n = (count > 0xff) ? 0xff : count;
+        esp_err_t ret = spi_fast_fpga_write(fpga_handle, FPGA_CMD_SET_IRQ, 1, n);
+        ESP_ERROR_CHECK(ret);
+        count -= n;
+    }
+}
+
+// Follow up a read of a prefetch port, either with the value the next read
+// returns or, when that is not known, with its properties to end the prefetch.
+// FPGA task only.
+static void IRAM_ATTR fpga_prefetch(fpga_context_t* ctx, uint8_t port)
+{
+    esp_err_t ret;
+    uint8_t next;
+
+    if (ioPortPeekPort(port, &next)) {
+        ret = spi_fpga_write_direct(ctx, FPGA_CMD_UPDATE, port, next);
+    } else {
+        ret = spi_fpga_write_direct(ctx, FPGA_CMD_SET_PROPERTIES, port, s_io_properties[port].val);
+    }
+    ESP_ERROR_CHECK(ret);
+}
+
+static inline IRAM_ATTR void fpga_hist_add(fpga_hist_t* hist, uint32_t cycles)
+{
+    uint32_t steps = cycles >> FPGA_HIST_SHIFT;
+    int bucket = steps ? 32 - __builtin_clz(steps) : 0;
+
+    hist->count++;
+    hist->sum += cycles;
+    if (cycles > hist->max) {
+        hist->max = cycles;
+    }
+    hist->buckets[MIN(bucket, FPGA_HIST_BUCKETS - 1)]++;
+}
+
+static uint32_t fpga_cycles_to_ns(uint64_t cycles)
+{
+    return cycles * 1000 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+}
+
+static void fpga_hist_print(const char* name, const fpga_hist_t* hist)
+{
+    printf("%-14s %8lu  avg %6lu ns  max %8lu ns\n", name, hist->count,
+           hist->count ? fpga_cycles_to_ns(hist->sum / hist->count) : 0, fpga_cycles_to_ns(hist->max));
+    for (int i = 0; i < FPGA_HIST_BUCKETS; i++) {
+        if (hist->buckets[i] == 0) {
+            continue;
+        }
+        if (i < FPGA_HIST_BUCKETS - 1) {
+            printf("    < %8lu ns %8lu\n", fpga_cycles_to_ns((1ull << i) << FPGA_HIST_SHIFT), hist->buckets[i]);
+        } else {
+            printf("    >= %7lu ns %8lu\n", fpga_cycles_to_ns((1ull << (i - 1)) << FPGA_HIST_SHIFT), hist->buckets[i]);
+        }
+    }
+}
+
+void fpga_latency_print(fpga_handle_t ctx)
+{
+    // Copy first, the handler task keeps counting
+    fpga_latency_t latency = ctx->latency;
+
+    fpga_hist_print("wake", &latency.wake);
+    fpga_hist_print("fetch", &latency.fetch);
+    fpga_hist_print("read handler", &latency.read_handler);
+    fpga_hist_print("read reply", &latency.read_reply);
+    fpga_hist_print("read total", &latency.read_total);
+    fpga_hist_print("write handler", &latency.write_handler);
+    fpga_hist_print("write total", &latency.write_total);
+    fpga_hist_print("cached read", &latency.notify);
+
+    // The MSX waits for the reads over IPC, cached reads are answered by the FPGA
+    printf("reads: %lu from the FPGA read cache, %lu over IPC\n", latency.notify.count, latency.read_total.count);
+
+    // Polled time runs past the 32-bit ns range within seconds
+    printf("poll window %lu us: %lu bursts by IRQ, %lu by polling, %lu windows missed, %lu cut by the %d us budget, %" PRIu64 " us polled, %lu responses\n",
+           ctx->poll_window_us, latency.irq_wakes, latency.poll_hits, latency.poll_misses,
+           latency.poll_capped, FPGA_POLL_BUDGET_US,
+           latency.poll_cycles / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, latency.responses);
+}
+
+void fpga_set_poll_window(fpga_handle_t ctx, uint32_t us)
+{
+    // Longer windows would be cut by the budget anyway, and the window in
+    // cycles has to fit 32 bits
+    ctx->poll_window_us = MIN(us, FPGA_POLL_BUDGET_US);
+}
+
+void fpga_set_read_prefetch(fpga_handle_t ctx, bool enable)
+{
+    ctx->read_prefetch = enable;
+    for (int port = 0; port <= 0xff; port++) {
+        if (s_io_prefetch[port] && s_io_properties[port].read_mode != 0) {
+            s_io_properties[port].read_mode = enable ? 2 : 3;
+        }
+    }
+    // Changed read modes are sent by the FPGA task, which also ends any
+    // prefetch in progress
+    if (!ctx->io_deferred) {
+        esp_err_t ret = spi_fast_fpga_write(ctx, FPGA_CMD_SYNC_PROPERTIES, 0, 0);
+        ESP_ERROR_CHECK(ret);
+    }
+}
+
+void fpga_latency_reset(fpga_handle_t ctx)
+{
+    memset(&ctx->latency, 0, sizeof(ctx->latency));
+}
+
 static IRAM_ATTR void isr_handler(void* arg)
 {
     fpga_context_t* fpga_handle = (fpga_context_t*)arg;
 
+    fpga_handle->irq_cycles = esp_cpu_get_cycle_count();
+    fpga_handle->irq_flag = true;
     gpio_intr_disable(fpga_handle->cfg.irq_io);
-    xSemaphoreGive(fpga_handle->interrupt_sem);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(fpga_handle->task, &woken);
+    portYIELD_FROM_ISR(woken);
 }
 
+// Claim the next command queue slot, any task. The slot sequence equals the
+// position while it is free for this lap.
+static bool IRAM_ATTR fpga_queue_push(fpga_context_t* ctx, uint32_t cmd)
+{
+    uint32_t pos = __atomic_load_n(&ctx->cmd_head, __ATOMIC_RELAXED);
+    fpga_cmd_slot_t* slot;
+
+    for (;;) {
+        slot = &ctx->cmd_queue[pos & (FPGA_CMD_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ctx->cmd_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // full, the FPGA task did not free this slot yet
+            return false;
+        } else {
+            pos = __atomic_load_n(&ctx->cmd_head, __ATOMIC_RELAXED);
+        }
+    }
+    slot->cmd = cmd;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Take the oldest posted command, FPGA task only
+static bool IRAM_ATTR fpga_queue_pop(fpga_context_t* ctx, uint32_t* cmd)
+{
+    uint32_t pos = ctx->cmd_tail;
+    fpga_cmd_slot_t* slot = &ctx->cmd_queue[pos & (FPGA_CMD_QUEUE_SIZE - 1)];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        // empty, or the poster is still filling the slot
+        return false;
+    }
+    *cmd = slot->cmd;
+    __atomic_store_n(&slot->seq, pos + FPGA_CMD_QUEUE_SIZE, __ATOMIC_RELEASE);
+    ctx->cmd_tail = pos + 1;
+    return true;
+}
+
+static void IRAM_ATTR fpga_exec_command(fpga_context_t* ctx, uint8_t cmd, uint8_t addr, uint8_t data)
+{
+    if (cmd == FPGA_CMD_SYNC_PROPERTIES) {
+        fpga_io_sync(ctx, data != 0);
+    } else {
+        esp_err_t ret = spi_fpga_write_direct(ctx, cmd, addr, data);
+        ESP_ERROR_CHECK(ret);
+    }
+}
+
+// Send the posted commands, FPGA task only. Slot IRQ changes only need
+// their last state sent, ADPCM credits are summed and repeated property
+// syncs done once.
+static void IRAM_ATTR fpga_drain_commands(fpga_context_t* ctx)
+{
+    int irq = -1;
+    uint32_t credits = 0;
+    int sync = -1;
+    uint32_t val;
+
+    while (fpga_queue_pop(ctx, &val)) {
+        uint8_t cmd = val >> 16;
+        uint8_t addr = val >> 8;
+        uint8_t data = val;
+
+        if (cmd == FPGA_CMD_SET_IRQ) {
+            if (addr == 0) {
+                irq = data;
+                continue;
+            }
+            if (addr == 1) {
+                credits += data;
+                continue;
+            }
+            // Credit clear, drops the credits collected so far
+            credits = 0;
+        }
+        if (cmd == FPGA_CMD_SYNC_PROPERTIES) {
+            sync = MAX(sync, data);
+            continue;
+        }
+        // Keep syncs in order with the other commands (global enable)
+        if (sync >= 0) {
+            fpga_exec_command(ctx, FPGA_CMD_SYNC_PROPERTIES, 0, sync);
+            sync = -1;
+        }
+        fpga_exec_command(ctx, cmd, addr, data);
+    }
+
+    if (sync >= 0) {
+        fpga_exec_command(ctx, FPGA_CMD_SYNC_PROPERTIES, 0, sync);
+    }
+    if (irq >= 0) {
+        fpga_exec_command(ctx, FPGA_CMD_SET_IRQ, 0, irq);
+    }
+    while (credits > 0) {
+        uint8_t n = MIN(credits, 0xff);
+        fpga_exec_command(ctx, FPGA_CMD_SET_IRQ, 1, n);
+        credits -= n;
+    }
+}
+
+// Send a command to the FPGA. The FPGA task (and fpga_create() before it
+// runs) writes directly, other tasks post it to the FPGA task.
 esp_err_t IRAM_ATTR spi_fast_fpga_write(fpga_context_t* ctx, uint8_t cmd, uint8_t addr, uint8_t data)
+{
+    if (ctx->task == NULL || ctx->task == xTaskGetCurrentTaskHandle()) {
+        fpga_exec_command(ctx, cmd, addr, data);
+        return ESP_OK;
+    }
+
+    uint32_t val = (cmd << 16) | (addr << 8) | data;
+    while (!fpga_queue_push(ctx, val)) {
+        // Queue full, let the FPGA task catch up
+        xTaskNotifyGive(ctx->task);
+        vTaskDelay(1);
+    }
+    xTaskNotifyGive(ctx->task);
+    return ESP_OK;
+}
+
+// Write a command on the bus, bus owner only
+static esp_err_t IRAM_ATTR spi_fpga_write_direct(fpga_context_t* ctx, uint8_t cmd, uint8_t addr, uint8_t data)
 {
     esp_err_t ret;
-    xSemaphoreTake(ctx->spi_sem, portMAX_DELAY);
 
     // First finish read when busy
-    if (ctx->read_fifo_busy) {
-        ret = spi_device_polling_end(ctx->spi, portMAX_DELAY);
-        ESP_ERROR_CHECK(ret);
-        ctx->read_fifo_busy = false;
-        ctx->read_fifo_value = *(uint32_t*)(&ctx->read_fifo_trans.base.rx_data[0]);
-    }
+    spi_fpga_finish_read(ctx);
 
     // Setup write transaction
     ctx->write_fifo_trans.base.cmd = cmd;
@@ -353,14 +957,22 @@ esp_err_t IRAM_ATTR spi_fast_fpga_write(fpga_context_t* ctx, uint8_t cmd, uint8_
     ret = llspi_device_polling_transmit(ctx->spi, &ctx->write_fifo_trans.base);
     ESP_ERROR_CHECK(ret);
 
-    xSemaphoreGive(ctx->spi_sem);
     return ret;
 }
 
-esp_err_t IRAM_ATTR spi_fpga_read(fpga_context_t* ctx, uint32_t* out_data)
+// Complete a batched read still running, its responses stay in the buffer
+static void IRAM_ATTR spi_fpga_finish_read(fpga_context_t* ctx)
 {
-    xSemaphoreTake(ctx->spi_sem, portMAX_DELAY);
+    if (ctx->read_fifo_busy) {
+        esp_err_t ret = spi_device_polling_end(ctx->spi, portMAX_DELAY);
+        ESP_ERROR_CHECK(ret);
+        ctx->read_fifo_busy = false;
+    }
+}
 
+// Read a single response, fpga_create() only
+esp_err_t IRAM_ATTR spi_fpga_read(fpga_context_t* ctx, uint32_t* out_data)
+{
     esp_err_t ret = spi_device_polling_start(ctx->spi, &ctx->read_fifo_trans.base, portMAX_DELAY);
     ESP_ERROR_CHECK(ret);
 
@@ -369,81 +981,235 @@ esp_err_t IRAM_ATTR spi_fpga_read(fpga_context_t* ctx, uint32_t* out_data)
 
     *out_data = *(uint32_t*)(&ctx->read_fifo_trans.base.rx_data[0]);
 
-    xSemaphoreGive(ctx->spi_sem);
     return ESP_OK;
 }
 
-static void IRAM_ATTR fpga_handle_communication(void *args)
+static void IRAM_ATTR fpga_batch_start(fpga_context_t* ctx, int batch, uint32_t count)
 {
-    fpga_handle_t ctx = (fpga_handle_t)args;
+    if (count > FPGA_BATCH_MAX) {
+        count = FPGA_BATCH_MAX;
+    }
+    uint32_t bits = (8 + 24 * count + 31) & ~31;
+    ctx->read_batch_trans[batch].base.rxlength = bits;
+    ctx->read_batch_slots[batch] = (bits - 8) / 24;
 
-    ESP_LOGI(TAG, "Handling interrupts ...");
-    while (1) {
-        uint32_t tick_to_wait = MAX(FPGA_BUSY_TIMEOUT_MS / portTICK_PERIOD_MS, 2);
-        BaseType_t ret = xSemaphoreTake(ctx->interrupt_sem, tick_to_wait);
-        if (ret != pdTRUE) {
-            continue;
+    llspi_device_wait_ready(ctx->spi);
+    ctx->batch_cycles[batch] = esp_cpu_get_cycle_count();
+    esp_err_t ret = spi_device_polling_start(ctx->spi, &ctx->read_batch_trans[batch].base, portMAX_DELAY);
+    ESP_ERROR_CHECK(ret);
+    ctx->read_fifo_busy = true;
+}
+
+// Start reading up to count responses in one transfer. The length is rounded
+// up to whole words, a response cut off at the end stays queued in the FPGA.
+static void IRAM_ATTR fpga_read_batch_start(fpga_context_t* ctx, int batch, uint32_t count)
+{
+    ctx->read_batch_trans[batch].base.cmd = FPGA_CMD_GET_RESPONSES;
+    ctx->read_batch_trans[batch].address_bits = 0;
+    ctx->read_batch_trans[batch].dummy_bits = 2;    // clocks
+    fpga_batch_start(ctx, batch, count);
+}
+
+// Same, with the reply to an IO read posted in front in the same transfer
+static void IRAM_ATTR fpga_reply_batch_start(fpga_context_t* ctx, int batch, uint32_t count, uint8_t addr, uint8_t data)
+{
+    ctx->read_batch_trans[batch].base.cmd = FPGA_CMD_REPLY_GET_RESPONSES;
+    ctx->read_batch_trans[batch].base.addr = (addr << 8) | data;
+    ctx->read_batch_trans[batch].address_bits = 16;
+    ctx->read_batch_trans[batch].dummy_bits = 1;    // clocks
+    fpga_batch_start(ctx, batch, count);
+}
+
+static bool IRAM_ATTR fpga_batch_has_read(const uint8_t* buf, uint32_t slots)
+{
+    for (uint32_t i = 0; i < slots; i++) {
+        uint8_t flags = buf[3 + 3 * i];
+        if ((flags & 0x80) && (flags & 0x0f) == FPGA_RESP_READ) {
+            return true;
         }
+    }
+    return false;
+}
 
-        xSemaphoreTake(ctx->spi_sem, portMAX_DELAY);
+// Read and handle responses until the FPGA has none left. IO latency is
+// counted from ref_cycles (IRQ) for the first batch, from the start of
+// their read for the later ones.
+static void IRAM_ATTR fpga_handle_responses(fpga_context_t* ctx, uint32_t ref_cycles)
+{
+    // Get the first response together with the number queued
+    int batch = 0;
+    fpga_read_batch_start(ctx, batch, 1);
 
-        // Get first response
-        ret = spi_device_polling_start(ctx->spi, &ctx->read_fifo_trans.base, portMAX_DELAY);
-        ESP_ERROR_CHECK(ret);
-        ctx->read_fifo_busy = true;
+    // Get response(s)
+    for(;;) {
+        if (ctx->read_fifo_busy) {
+            esp_err_t ret = spi_device_polling_end(ctx->spi, portMAX_DELAY);
+            ESP_ERROR_CHECK(ret);
+            ctx->read_fifo_busy = false;
+        }
+        fpga_hist_add(&ctx->latency.fetch, esp_cpu_get_cycle_count() - ctx->batch_cycles[batch]);
+        const uint8_t* buf = (const uint8_t*)ctx->read_batch_buf[batch];
+        uint32_t slots = ctx->read_batch_slots[batch];
+        uint32_t queued = buf[0];
+
+        uint32_t next = (queued > slots) ? queued - slots : 1;
+
+        // The FPGA ran empty when the last response is not valid, its IRQ
+        // is reset then. Otherwise fetch the rest while decoding this batch.
+        // The MSX is stalled on a read until it is answered, the reply
+        // fetches the next batch then.
+        bool more = (buf[3 * slots] & 0x80) != 0;
+        if (more && !fpga_batch_has_read(buf, slots)) {
+            fpga_read_batch_start(ctx, batch ^ 1, next);
+        }
 
-        // Get response(s)
-        for(;;) {
-            // Get the response
+        for (uint32_t i = 0; i < slots; i++) {
             fpga_response_t resp;
-            if (ctx->read_fifo_busy) {
-                ret = spi_device_polling_end(ctx->spi, portMAX_DELAY);
-                ESP_ERROR_CHECK(ret);
-                ctx->read_fifo_busy = false;
-                ctx->read_fifo_value = *(uint32_t*)(&ctx->read_fifo_trans.base.rx_data[0]);
-            }
-            resp.val = ctx->read_fifo_value;
+            const uint8_t* p = &buf[1 + 3 * i];
+            resp.val = p[0] | (p[1] << 8) | (p[2] << 16);
+            uint32_t start = esp_cpu_get_cycle_count();
             if (!resp.valid)
-                // No more responses
-                break;
-
-            // Prefetch the next response
-            llspi_device_wait_ready(ctx->spi);
-            ret = spi_device_polling_start(ctx->spi, &ctx->read_fifo_trans.base, portMAX_DELAY);
-            ESP_ERROR_CHECK(ret);
-            ctx->read_fifo_busy = true;
+                continue;
+            ctx->latency.responses++;
 
             // Process the response
             switch(resp.resp) {
-                case FPGA_RESP_RESET:
+                case FPGA_RESP_RESET: {
                     ESP_LOGI(TAG, "Reset ...");
-                    xSemaphoreGive(ctx->spi_sem);
+                    int64_t treset = esp_timer_get_time();
                     ctx->reset_callback(ctx->reset_callback_ref);
-                    xSemaphoreTake(ctx->spi_sem, portMAX_DELAY);
+                    ESP_LOGI(TAG, "Reset handled in %lld us", esp_timer_get_time() - treset);
                     break;
+                }
                 case FPGA_RESP_READ:
-                    // IO Read
-                    xSemaphoreGive(ctx->spi_sem);
+                    // IO Read, the MSX waits for the reply
                     uint8_t data = ioPortReadPort(resp.addr);
+                    uint32_t handled = esp_cpu_get_cycle_count();
                     //ESP_LOGI(TAG, "IO read 0x%x -> 0x%x", resp.addr, data);
-                    ret = spi_fast_fpga_write(ctx, FPGA_CMD_UPDATE, resp.addr, data);
-                    ESP_ERROR_CHECK(ret);
-                    xSemaphoreTake(ctx->spi_sem, portMAX_DELAY);
+                    if (!ctx->read_fifo_busy) {
+                        fpga_reply_batch_start(ctx, batch ^ 1, next, resp.addr, data);
+                        more = true;
+                    } else {
+                        esp_err_t ret = spi_fpga_write_direct(ctx, FPGA_CMD_UPDATE, resp.addr, data);
+                        ESP_ERROR_CHECK(ret);
+                    }
+                    uint32_t replied = esp_cpu_get_cycle_count();
+                    fpga_hist_add(&ctx->latency.read_handler, handled - start);
+                    fpga_hist_add(&ctx->latency.read_reply, replied - handled);
+                    fpga_hist_add(&ctx->latency.read_total, replied - ref_cycles);
+                    if (s_io_properties[resp.addr].read_mode == 2) {
+                        fpga_prefetch(ctx, resp.addr);
+                    }
+                    break;
+                case FPGA_RESP_NOTIFY:
+                    // IO Read answered from the prefetched value, apply its side effects
+                    ioPortReadPort(resp.addr);
+                    fpga_prefetch(ctx, resp.addr);
+                    fpga_hist_add(&ctx->latency.notify, esp_cpu_get_cycle_count() - start);
                     break;
                 case FPGA_RESP_WRITE:
                     // IO Write
                     //ESP_LOGI(TAG, "IO write 0x%x = 0x%x", resp.addr, resp.data);
-                    xSemaphoreGive(ctx->spi_sem);
                     ioPortWritePort(resp.addr, resp.data);
-                    xSemaphoreTake(ctx->spi_sem, portMAX_DELAY);
+                    uint32_t written = esp_cpu_get_cycle_count();
+                    fpga_hist_add(&ctx->latency.write_handler, written - start);
+                    fpga_hist_add(&ctx->latency.write_total, written - ref_cycles);
                     break;
                 default:
                     ESP_LOGW(TAG, "Unknown FPGA response: 0x%x", resp.val);
             }
         }
 
+        // Commands posted meanwhile go out between the batches
+        fpga_drain_commands(ctx);
+
+        if (!more)
+            // No more responses
+            break;
+        batch ^= 1;
+        ref_cycles = ctx->batch_cycles[batch];
+    }
+}
+
+// Poll the IRQ line for the next burst, the interrupt stays disabled.
+// Posted commands are sent meanwhile. Polling is limited to the budget of
+// the current tick, so back to back bursts can not keep the mixer worker on
+// this core from running.
+static bool IRAM_ATTR fpga_poll(fpga_context_t* ctx, uint32_t* ref_cycles)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint32_t window = ctx->poll_window_us * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+
+    TickType_t tick = xTaskGetTickCount();
+    if (tick != ctx->poll_tick) {
+        ctx->poll_tick = tick;
+        ctx->poll_budget = FPGA_POLL_BUDGET_US * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+    }
+    bool capped = window > ctx->poll_budget;
+    if (capped) {
+        window = ctx->poll_budget;
+    }
+
+    for (;;) {
+        uint32_t now = esp_cpu_get_cycle_count();
+        uint32_t elapsed = now - start;
+        if (gpio_get_level(ctx->cfg.irq_io)) {
+            ctx->latency.poll_hits++;
+            ctx->latency.poll_cycles += elapsed;
+            ctx->poll_budget -= MIN(elapsed, ctx->poll_budget);
+            *ref_cycles = now;
+            return true;
+        }
+        if (elapsed >= window) {
+            if (capped) {
+                ctx->latency.poll_capped++;
+            } else if (window > 0) {
+                ctx->latency.poll_misses++;
+            }
+            ctx->latency.poll_cycles += elapsed;
+            ctx->poll_budget -= MIN(elapsed, ctx->poll_budget);
+            return false;
+        }
+        fpga_drain_commands(ctx);
+    }
+}
+
+static void IRAM_ATTR fpga_handle_communication(void *args)
+{
+    fpga_handle_t ctx = (fpga_handle_t)args;
+
+    // Arm the interrupt from here, its ISR then runs on the core of this task:
+    // the cycle counters compare and the wake up is a local task switch
+    gpio_install_isr_service(0);
+    gpio_set_intr_type(ctx->cfg.irq_io, GPIO_INTR_HIGH_LEVEL);
+    esp_err_t err = gpio_isr_handler_add(ctx->cfg.irq_io, isr_handler, ctx);
+    ESP_ERROR_CHECK(err);
+
+    ESP_LOGI(TAG, "Handling interrupts ...");
+    while (1) {
+        uint32_t tick_to_wait = MAX(FPGA_BUSY_TIMEOUT_MS / portTICK_PERIOD_MS, 2);
+        if (ulTaskNotifyTake(pdTRUE, tick_to_wait) == 0) {
+            continue;
+        }
+
+        // Commands posted by other tasks
+        fpga_drain_commands(ctx);
+        if (!ctx->irq_flag) {
+            continue;
+        }
+        ctx->irq_flag = false;
+
+        ctx->latency.irq_wakes++;
+        fpga_hist_add(&ctx->latency.wake, esp_cpu_get_cycle_count() - ctx->irq_cycles);
+
+        // Handle the burst, and the ones following shortly after without
+        // the interrupt round trip
+        uint32_t ref_cycles = ctx->irq_cycles;
+        do {
+            fpga_handle_responses(ctx, ref_cycles);
+        } while (fpga_poll(ctx, &ref_cycles));
+
         // Enable interrupt again
-        xSemaphoreGive(ctx->spi_sem);
         gpio_intr_enable(ctx->cfg.irq_io);
     }
     vTaskDelete(NULL);
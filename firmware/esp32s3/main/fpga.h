@@ -41,13 +41,31 @@ void fpga_set_reset_callback(fpga_handle_t ctx, reset_callback_t reset_callback,
 void fpga_io_start(fpga_handle_t fpga_handle);
 void fpga_io_stop(fpga_handle_t fpga_handle);
 
+// Reset clears the port properties and holds them back until the commit,
+// which sends the registrations made meanwhile and enables IO
 void fpga_io_reset(fpga_handle_t fpga_handle);
+void fpga_io_commit(fpga_handle_t fpga_handle);
 void fpga_io_register(fpga_handle_t fpga_handle, uint8_t port, IoPortProperties_t prop);
 void fpga_io_unregister(fpga_handle_t fpga_handle, uint8_t port);
 
 void fpga_irq_set(fpga_handle_t fpga_handle);
 void fpga_irq_reset(fpga_handle_t fpga_handle);
 
+// Grant free ADPCM FIFO space, the FPGA keeps BUF_RDY set while credits remain
+void fpga_adpcm_credit(fpga_handle_t fpga_handle, uint32_t count);
+
+// Print the IO handling latency histograms to stdout, or clear them
+void fpga_latency_print(fpga_handle_t fpga_handle);
+void fpga_latency_reset(fpga_handle_t fpga_handle);
+
+// Time to keep polling for IO after a burst before waiting for the interrupt,
+// at most the polling budget per tick
+void fpga_set_poll_window(fpga_handle_t fpga_handle, uint32_t us);
+
+// Answer sequential reads (memory data) from the FPGA read cache, or read
+// every value over IPC
+void fpga_set_read_prefetch(fpga_handle_t fpga_handle, bool enable);
+
 
 #ifdef __cplusplus
 }
@@ -95,9 +95,11 @@ static esp_err_t dac_codec_init(i2s_chan_handle_t tx_handle, i2s_chan_handle_t r
     return ESP_OK;
 }
 
-static esp_err_t i2s_driver_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t *rx_handle)
+static esp_err_t i2s_driver_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t *rx_handle, uint32_t dma_frame_num, uint32_t dma_desc_num, i2s_isr_callback_t tx_sent_callback, void *ref)
 {
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM, I2S_ROLE_MASTER);
+    chan_cfg.dma_frame_num = dma_frame_num;
+    chan_cfg.dma_desc_num = dma_desc_num;
     chan_cfg.auto_clear = true; // Auto clear the legacy data in the DMA buffer
     ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, tx_handle, rx_handle));
     i2s_std_config_t std_cfg = {
@@ -120,16 +122,23 @@ static esp_err_t i2s_driver_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t
 
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(*tx_handle, &std_cfg));
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(*rx_handle, &std_cfg));
+    if (tx_sent_callback != NULL) {
+        // Callbacks can only be registered before the channel is enabled
+        i2s_event_callbacks_t cbs = {
+            .on_sent = tx_sent_callback,
+        };
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(*tx_handle, &cbs, ref));
+    }
     ESP_ERROR_CHECK(i2s_channel_enable(*tx_handle));
     ESP_ERROR_CHECK(i2s_channel_enable(*rx_handle));
     return ESP_OK;
 }
 
-void i2s_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t *rx_handle)
+void i2s_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t *rx_handle, uint32_t dma_frame_num, uint32_t dma_desc_num, i2s_isr_callback_t tx_sent_callback, void *ref)
 {
     printf("i2s dac codec start\n-----------------------------\n");
     /* Initialize i2s peripheral */
-    if (i2s_driver_init(tx_handle, rx_handle) != ESP_OK) {
+    if (i2s_driver_init(tx_handle, rx_handle, dma_frame_num, dma_desc_num, tx_sent_callback, ref) != ESP_OK) {
         ESP_LOGE(TAG, "i2s driver init failed");
         abort();
     } else {
@@ -22,6 +22,6 @@
 
 #include <driver/i2s_std.h>
 
-void i2s_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t *rx_handle);
+void i2s_init(i2s_chan_handle_t *tx_handle, i2s_chan_handle_t *rx_handle, uint32_t dma_frame_num, uint32_t dma_desc_num, i2s_isr_callback_t tx_sent_callback, void *ref);
 
 void i2s_play_music(i2s_chan_handle_t tx_handle);
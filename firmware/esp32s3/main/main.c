@@ -24,10 +24,15 @@
 #include <freertos/FreeRTOS.h>
 #include <sdkconfig.h>
 #include <esp_log.h>
+#include <nvs_flash.h>
 
 #include "i2s.h"
 #include "fpga.h"
 #include "audiodev.h"
+#include "console.h"
+#ifdef RUN_BENCHMARK
+#include "benchmark.h"
+#endif
 
 static const char TAG[] = "main";
 
@@ -62,6 +67,15 @@ static uint32_t i2s_write_output_callback(void* arg, int16_t* buffer, uint32_t c
     return bytes_done / sizeof(int16_t);
 }
 
+static bool IRAM_ATTR i2s_tx_sent_callback(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    // A DMA buffer has been played, this clocks the audio mixer
+    if (audiodev != NULL) {
+        return audiodev_clock_event(audiodev, event->size / (2 * sizeof(int16_t)));
+    }
+    return false;
+}
+
 void reset_callback(void* ref)
 {
     audiodev_handle_t audiodev = (audiodev_handle_t)ref;
@@ -71,7 +85,15 @@ void reset_callback(void* ref)
 
 void ipc_main(void)
 {
-    i2s_init(&tx_handle, &rx_handle);
+    // NVS holds the FPGA link calibration
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    i2s_init(&tx_handle, &rx_handle, AUDIO_BLOCK_SIZE, AUDIO_BLOCK_COUNT, i2s_tx_sent_callback, NULL);
 
     fpga = fpga_create();
     if (fpga == NULL)
@@ -80,10 +102,17 @@ void ipc_main(void)
     audiodev = audiodev_create(fpga, i2s_read_input_callback, i2s_write_output_callback);
 
     fpga_set_reset_callback(fpga, reset_callback, audiodev);
+
+    console_init(fpga);
 }
 
 void app_main(void)
 {
+#ifdef RUN_BENCHMARK
+    // Benchmark the audio engine at boot, idf.py -DRUN_BENCHMARK=ON build
+    benchmark_run();
+#endif
+
     ipc_main();
 
     while (1) {
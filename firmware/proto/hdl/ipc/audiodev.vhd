@@ -34,6 +34,11 @@ entity audiodev is
     -- Audio data
     audio_data         : in std_logic_vector(15 downto 0);
 
+    -- ADPCM FIFO credits granted by the ESP32
+    adpcm_credit       : in std_logic_vector(7 downto 0);
+    adpcm_credit_valid : in std_logic;
+    adpcm_credit_clear : in std_logic;
+
     -- io slave port
     ios_read           : in std_logic;
     ios_write          : in std_logic;
@@ -130,6 +135,10 @@ architecture rtl of audiodev is
   signal reset_bufrdy_i : std_logic;
   signal bufrdy_timer_x, bufrdy_timer_r : integer range 0 to C_BUFRDY_TIME-1;
 
+  -- Free bytes in the ESP32 ADPCM FIFO, BUF_RDY is only set while this is non-zero
+  signal adpcm_credits_x, adpcm_credits_r : unsigned(9 downto 0);
+  signal adpcm_data_write_i             : std_logic;
+
   constant C_TIMER_CLKDIV : integer := 286; -- 12.5 kHz timer base (3.58MHz/286 = 12.516 kHz)
   signal timer_clkdiv_x, timer_clkdiv_r : integer range 0 to C_TIMER_CLKDIV-1;
   signal timer_tick_x, timer_tick_r                         : std_logic;
@@ -237,6 +246,7 @@ begin
 
     bufrdy_timer_x <= bufrdy_timer_r;
     reset_bufrdy_i <= '0';
+    adpcm_data_write_i <= '0';
 
     start_playing_i <= '0';
     play_sample_i <= '0';
@@ -281,11 +291,31 @@ begin
       end if;
     end if;
 
+    -- ADPCM FIFO credits, the ESP32 grants free FIFO space and every byte
+    -- written in CPU synthesis mode consumes one
+    if (adpcm_credit_clear = '1') then
+      adpcm_credits_x <= (others => '0');
+    elsif (adpcm_credit_valid = '1' and adpcm_data_write_i = '0') then
+      adpcm_credits_x <= adpcm_credits_r + unsigned(adpcm_credit);
+    elsif (adpcm_credit_valid = '1' and adpcm_data_write_i = '1') then
+      adpcm_credits_x <= adpcm_credits_r + unsigned(adpcm_credit) - 1;
+    elsif (adpcm_data_write_i = '1' and adpcm_credits_r /= 0) then
+      adpcm_credits_x <= adpcm_credits_r - 1;
+    else
+      adpcm_credits_x <= adpcm_credits_r;
+    end if;
+
     -- Buffer ready timer
     if (reset_bufrdy_i = '1') then
       opl1_status_bufrdy_x <= '0';
       bufrdy_timer_x <= C_BUFRDY_TIME-1;
+    elsif (reg7_r(7) = '1' and reg7_r(6) = '0' and reg7_r(5) = '0') then
+      -- CPU synthesis playback (not record), ready as long as the ESP32 FIFO has space
+      if (adpcm_credits_r /= 0) then
+        opl1_status_bufrdy_x <= '1';
+      end if;
     elsif (reg7_r(7) = '1' and reg7_r(5) = '0') then
+      -- Record from CPU, ready per sample as before
       if (play_sample_i = '1') then
         opl1_status_bufrdy_x <= '1';
       end if;
@@ -383,6 +413,7 @@ begin
           end if;
           if (reg7_r(7 downto 5) = "100") then
             -- ADPCM synthesis from CPU
+            adpcm_data_write_i <= '1';
             reset_bufrdy_i <= '1';
           end if;
 
@@ -724,6 +755,7 @@ begin
         opl1_status_int_r <= '0';
         opl1_status_pcmbsy_r <= '0';
         bufrdy_timer_r <= 0;
+        adpcm_credits_r <= (others => '0');
         prescale_r <= 0;
         clkena_samp_r <= '0';
         timer_clkdiv_r <= 0;
@@ -778,6 +810,7 @@ begin
         opl1_status_int_r <= opl1_status_int_x;
         opl1_status_pcmbsy_r <= opl1_status_pcmbsy_x;
         bufrdy_timer_r <= bufrdy_timer_x;
+        adpcm_credits_r <= adpcm_credits_x;
         prescale_r <= prescale_x;
         clkena_samp_r <= clkena_samp_x;
         timer_clkdiv_r <= timer_clkdiv_x;
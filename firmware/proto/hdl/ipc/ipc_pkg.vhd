@@ -23,9 +23,15 @@ package ipc is
       read_mode       : read_mode_t;
   end record;
 
+  -- In t_rdmode_cache_notify the remote follows every notify (and every read
+  -- it answers) with one more update (the next value, prefetched) or with
+  -- set_properties when the next value can not be known ahead.
   type ioram_data_t is record
       properties      : ioram_properties_t;
       readdata        : std_logic_vector(7 downto 0);
+      prefetched      : std_logic;  -- readdata holds the next value to read
+      prefetch_busy   : std_logic;  -- a follow-up from the remote is on its way
+      prefetch_stale  : std_logic;  -- port was written, drop that follow-up
   end record;
 
   -- Conversion functions
@@ -35,7 +41,7 @@ package ipc is
     return ioram_properties_t;
   function to_std_logic_vector(i : ioram_data_t)
     return std_logic_vector;
-  function from_std_logic_vector(i : std_logic_vector(11 downto 0))
+  function from_std_logic_vector(i : std_logic_vector(14 downto 0))
     return ioram_data_t;
 
   -- Command over fifo host->remote
@@ -124,16 +130,22 @@ package body ipc is
   end;
 
   function to_std_logic_vector(i : ioram_data_t) return std_logic_vector is
-      variable o : std_logic_vector(11 downto 0);
+      variable o : std_logic_vector(14 downto 0);
   begin
+      o(14) := i.prefetched;
+      o(13) := i.prefetch_busy;
+      o(12) := i.prefetch_stale;
       o(11 downto 8) := to_std_logic_vector(i.properties);
       o(7 downto 0) := i.readdata;
       return o;
   end;
 
-  function from_std_logic_vector(i : std_logic_vector(11 downto 0)) return ioram_data_t is
+  function from_std_logic_vector(i : std_logic_vector(14 downto 0)) return ioram_data_t is
       variable o : ioram_data_t;
   begin
+      o.prefetched := i(14);
+      o.prefetch_busy := i(13);
+      o.prefetch_stale := i(12);
       o.properties := from_std_logic_vector(i(11 downto 8));
       o.readdata := i(7 downto 0);
       return o;
@@ -12,6 +12,10 @@ entity spi_ipc is
     clock                       : in  std_logic;
     slot_reset                  : in  std_logic;
     slot_irq                    : out std_logic;
+    -- ADPCM FIFO credits
+    adpcm_credit                : out std_logic_vector(7 downto 0);
+    adpcm_credit_valid          : out std_logic;
+    adpcm_credit_clear          : out std_logic;
     -- IO bus
     ios_read                    : in  std_logic;
     ios_write                   : in  std_logic;
@@ -30,7 +34,7 @@ end entity spi_ipc;
 
 architecture rtl of spi_ipc is
 
-  type write_state_t is (WS_RESET, WS_IDLE, WS_FIFO_READ, WS_WRITE_START, WS_READ_START);
+  type write_state_t is (WS_RESET, WS_IDLE, WS_FIFO_READ, WS_FIFO_MODIFY, WS_WRITE_START, WS_PAIR_READ, WS_PAIR_MODIFY, WS_READ_START);
   signal write_state_x, write_state_r : write_state_t;
   signal io_enabled_x, io_enabled_r : std_logic;
   signal pending_read_x, pending_read_r : std_logic;
@@ -39,12 +43,12 @@ architecture rtl of spi_ipc is
   signal ios_address_x, ios_address_r     : std_logic_vector(7 downto 0);
   signal ios_writedata_x, ios_writedata_r : std_logic_vector(7 downto 0);
   
-  type ioram_t is array(0 to 255) of std_logic_vector(11 downto 0);
+  type ioram_t is array(0 to 255) of std_logic_vector(14 downto 0);
   signal ioram_memory             : ioram_t;
   signal ioram_write              : std_logic;
   signal ioram_address            : std_logic_vector(7 downto 0);
-  signal ioram_wrdata             : std_logic_vector(11 downto 0);
-  signal ioram_rddata             : std_logic_vector(11 downto 0);
+  signal ioram_wrdata             : std_logic_vector(14 downto 0);
+  signal ioram_rddata             : std_logic_vector(14 downto 0);
   signal ioram_rddata_i           : ioram_data_t;
   signal ioram_wrdata_i           : ioram_data_t;
 
@@ -65,17 +69,19 @@ architecture rtl of spi_ipc is
   signal ofifo_wrreq	            : std_logic;
   signal ofifo_q	                : std_logic_vector (OFIFO_BIT_WIDTH-1 downto 0);
   signal ofifo_rdempty	          : std_logic;
+  signal ofifo_rdusedw	          : std_logic_vector (7 downto 0);
   signal ofifo_wrfull	            : std_logic;
   signal ofifo_data_i             : ofifo_data_t;
 
-  type spi_state_t is (SS_C0, SS_C1, SS_C2, SS_IFIFO_C3, SS_IFIFO_C4, SS_IFIFO_C5, SS_IFIFO_C6,
-                       SS_OFIFO_C3, SS_OFIFO_C4, SS_OFIFO_C5, SS_OFIFO_C6, SS_OFIFO_C7, SS_OFIFO_C8);
+  type spi_state_t is (SS_C0, SS_C1, SS_C2, SS_IFIFO_C3, SS_IFIFO_C4, SS_IFIFO_C5, SS_IFIFO_C6, SS_BULK,
+                       SS_COUNT_C3, SS_COUNT_C4, SS_OFIFO_C3, SS_OFIFO_C4, SS_OFIFO_C5, SS_OFIFO_C6, SS_OFIFO_C7, SS_OFIFO_C8);
   signal spi_state_x, spi_state_r     : spi_state_t;
   signal spi_out_x, spi_out_r         : std_logic_vector(3 downto 0);
   signal spi_oe_x, spi_oe_r           : std_logic;
   signal spi_command_x, spi_command_r : std_logic_vector(3 downto 0);
   signal spi_address_x, spi_address_r : std_logic_vector(7 downto 0);
   signal spi_dvalid_x, spi_dvalid_r   : std_logic;
+  signal spi_count_x, spi_count_r     : std_logic_vector(7 downto 0);
   signal spi_data_x, spi_data_r       : std_logic_vector(7 downto 0);
   signal spi_irq_set_i, spi_irq_set_ff : std_logic;
   signal spi_irq_reset_i              : std_logic;
@@ -203,7 +209,7 @@ begin
 		q => ofifo_q,
 		rdempty => ofifo_rdempty,
 		rdfull => open,
-		rdusedw => open,
+		rdusedw => ofifo_rdusedw,
 		wrempty => open,
 		wrfull => ofifo_wrfull,
 		wrusedw => open
@@ -250,6 +256,11 @@ begin
     spi_irq_set_i <= '0';
     slot_irq_x <= slot_irq_r;
 
+    -- ADPCM FIFO credits
+    adpcm_credit <= ififo_q_i.data;
+    adpcm_credit_valid <= '0';
+    adpcm_credit_clear <= '0';
+
     -- State machine
     case (write_state_r) is
     when WS_RESET =>
@@ -275,6 +286,7 @@ begin
 
     when WS_FIFO_READ =>
       ioram_address <= ififo_q_i.address;
+      write_state_x <= WS_IDLE;
       case (ififo_q_i.command) is
       when t_incmd_loopback =>
         ofifo_data_i.command <= t_remote_loopback;
@@ -282,20 +294,56 @@ begin
         ofifo_data_i.writedata <= ififo_q_i.data;
         ofifo_wrreq <= not ofifo_wrfull;
         spi_irq_set_i <= not ofifo_wrfull;
+      when t_incmd_update | t_incmd_set_properties =>
+        -- Read-modify-write, the RAM output still holds the entry of the bus address
+        write_state_x <= WS_FIFO_MODIFY;
+      when t_incmd_set_irq =>
+        if (ififo_q_i.address = x"01") then
+          -- Grant ADPCM FIFO credits
+          adpcm_credit_valid <= '1';
+        elsif (ififo_q_i.address = x"02") then
+          -- Drop the ADPCM FIFO credits, e.g. ones granted by garbled commands during SPI calibration
+          adpcm_credit_clear <= '1';
+        else
+          -- Set IRQ
+          slot_irq_x <= ififo_q_i.data(0);
+        end if;
+      end case;
+
+    when WS_FIFO_MODIFY =>
+      ioram_address <= ififo_q_i.address;
+      ioram_write <= '1';
+      case (ififo_q_i.command) is
       when t_incmd_update =>
-        -- Update data in RAM, clear pending bit
-        ioram_write <= '1';
-        ioram_wrdata_i.readdata <= ififo_q_i.data;
-        -- If this matches a pending read, return the data
-        if (pending_read_r = '1' and pending_address_r = ios_address_r) then
-          pending_read_x <= '0';
-          ios_readdatavalid <= '1';
-          ios_readdata <= '1' & ififo_q_i.data;
+        if (ioram_rddata_i.properties.read_mode = t_rdmode_cache_notify and ioram_rddata_i.prefetch_busy = '1') then
+          -- Follow-up with the next value, unless the port was written meanwhile
+          ioram_wrdata_i.prefetch_busy <= '0';
+          ioram_wrdata_i.prefetch_stale <= '0';
+          if (ioram_rddata_i.prefetch_stale = '0') then
+            ioram_wrdata_i.readdata <= ififo_q_i.data;
+            ioram_wrdata_i.prefetched <= '1';
+          end if;
+        else
+          -- Update data in RAM
+          ioram_wrdata_i.readdata <= ififo_q_i.data;
+          -- If this matches a pending read, return the data and clear pending bit
+          if (pending_read_r = '1' and pending_address_r = ififo_q_i.address) then
+            pending_read_x <= '0';
+            ios_readdatavalid <= '1';
+            ios_readdata <= '1' & ififo_q_i.data;
+            if (ioram_rddata_i.properties.read_mode = t_rdmode_cache_notify) then
+              -- value is consumed, the remote follows up
+              ioram_wrdata_i.prefetched <= '0';
+              ioram_wrdata_i.prefetch_busy <= '1';
+            end if;
+          end if;
         end if;
       when t_incmd_set_properties =>
-        -- Write properties
-        ioram_write <= '1';
+        -- Write properties, this also ends a prefetch follow-up
         ioram_wrdata_i.properties <= from_std_logic_vector(ififo_q_i.data(3 downto 0));
+        ioram_wrdata_i.prefetched <= '0';
+        ioram_wrdata_i.prefetch_busy <= '0';
+        ioram_wrdata_i.prefetch_stale <= '0';
         if (ififo_q_i.address = x"ff") then
           if (ififo_q_i.data = x"55" ) then
             io_enabled_x <= '1';
@@ -303,9 +351,8 @@ begin
             io_enabled_x <= '0';
           end if;
         end if;
-      when t_incmd_set_irq =>
-        -- Set IRQ
-        slot_irq_x <= ififo_q_i.data(0);
+      when others =>
+        ioram_write <= '0';
       end case;
       write_state_x <= WS_IDLE;
 
@@ -315,17 +362,38 @@ begin
           ioram_wrdata_i.readdata <= ios_writedata_r;
           ioram_write <= '1';
       end if;
+      if (ioram_rddata_i.properties.read_mode = t_rdmode_cache_notify) then
+          -- A write can change what is read next, drop the prefetched value
+          ioram_wrdata_i.prefetched <= '0';
+          ioram_wrdata_i.prefetch_stale <= ioram_rddata_i.prefetch_busy;
+          ioram_write <= '1';
+      end if;
       if (ioram_rddata_i.properties.write_ipc = '1') then
         ofifo_data_i.command <= t_remote_write;
         if (ofifo_wrfull = '0') then
             ofifo_wrreq <= '1';
             spi_irq_set_i <= '1';
-            write_state_x <= WS_IDLE;
+            write_state_x <= WS_PAIR_READ;
         end if;
       else
-        write_state_x <= WS_IDLE;
+        write_state_x <= WS_PAIR_READ;
       end if;
 
+    when WS_PAIR_READ =>
+      -- Chips decode an address/data port pair, a write to either port
+      -- can change what the data port reads next
+      ioram_address <= ios_address_r xor x"01";
+      write_state_x <= WS_PAIR_MODIFY;
+
+    when WS_PAIR_MODIFY =>
+      ioram_address <= ios_address_r xor x"01";
+      if (ioram_rddata_i.properties.read_mode = t_rdmode_cache_notify) then
+          ioram_wrdata_i.prefetched <= '0';
+          ioram_wrdata_i.prefetch_stale <= ioram_rddata_i.prefetch_busy;
+          ioram_write <= '1';
+      end if;
+      write_state_x <= WS_IDLE;
+
     when WS_READ_START =>
       ioram_address <= ios_address_r;
       if (io_enabled_r = '0') then
@@ -345,15 +413,31 @@ begin
             ios_readdata <= '1' & ioram_rddata_i.readdata;
             write_state_x <= WS_IDLE;
         when t_rdmode_cache_notify =>
-            -- return data from RAM + notify
-            ios_readdatavalid <= '1';
-            ios_readdata <= '1' & ioram_rddata_i.readdata;
-            if (ofifo_wrfull = '0') then
-              spi_irq_set_i <= '1';
-              ofifo_wrreq <= '1';
+            if (ioram_rddata_i.prefetched = '1') then
+              -- return prefetched data from RAM + notify, the remote
+              -- applies the read and follows up with the next value
               ofifo_data_i.command <= t_remote_notify;
               ofifo_data_i.writedata <= ioram_rddata_i.readdata;
-              write_state_x <= WS_IDLE;
+              if (ofifo_wrfull = '0') then
+                ios_readdatavalid <= '1';
+                ios_readdata <= '1' & ioram_rddata_i.readdata;
+                spi_irq_set_i <= '1';
+                ofifo_wrreq <= '1';
+                ioram_wrdata_i.prefetched <= '0';
+                ioram_wrdata_i.prefetch_busy <= '1';
+                ioram_write <= '1';
+                write_state_x <= WS_IDLE;
+              end if;
+            else
+              -- nothing prefetched, read over IPC
+              ofifo_data_i.command <= t_remote_read;
+              pending_read_x <= '1';
+              pending_address_x <= ios_address_r;
+              if (ofifo_wrfull = '0') then
+                spi_irq_set_i <= '1';
+                ofifo_wrreq <= '1';
+                write_state_x <= WS_IDLE;
+              end if;
             end if;
         when t_rdmode_ipc =>
             -- read over IPC, send read command to remote
@@ -396,6 +480,40 @@ begin
   --  C5   data     OUT
   --  C6   data     OUT
   --  C7   data     OUT
+  --  C8   data     OUT  Next data is read from fifo
+  --  C3.. repeats while clocks continue, bit 23 flags valid data
+  --
+  -- Batched read from OFIFO transaction (command bit 0 set)
+  --
+  -- Clock Phase    Dir  Note
+  --  C0   command  In
+  --  C1   dummy    -
+  --  C2   dummy    -    Data is read from fifo, responses are counted
+  --  C3   count    OUT  Responses available, saturated at 255
+  --  C4   count    OUT
+  --  C5.. data     OUT  Responses as above, 6 clocks each
+  --
+  -- Reply and read transaction (command bit 1 set), answers a read and
+  -- fetches the next responses in one go
+  --
+  -- Clock Phase    Dir  Note
+  --  C0   command  In
+  --  C1   address  In
+  --  C2   address  In
+  --  C3   data     In
+  --  C4   data     In
+  --  C5   dummy    -    Update is written to IFIFO, data is read from fifo
+  --  C6.. as from C3 of the (batched) read from OFIFO
+  --
+  -- Bulk properties transaction (command bit 2 set), uploads a range of the
+  -- port table
+  --
+  -- Clock Phase    Dir  Note
+  --  C0   command  In
+  --  C1   address  In   First port
+  --  C2   address  In
+  --  C3   props    In   Properties of the first port, written to IFIFO
+  --  C4.. props    In   Properties of the following ports, until CS ends it
   --
   process(all)
   begin
@@ -412,12 +530,35 @@ begin
     spi_address_x <= spi_address_r;
     spi_data_x <= spi_data_r;
     spi_dvalid_x <= spi_dvalid_r;
+    spi_count_x <= spi_count_r;
 
     ififo_data_i.command <= from_std_logic_vector(spi_command_r(1 downto 0));
+    if (spi_command_r(3) = '1') then
+      -- reply to a read
+      ififo_data_i.command <= t_incmd_update;
+    end if;
     ififo_data_i.address <= spi_address_r;
     ififo_data_i.data <= spi_data_r;
     ififo_data <= to_std_logic_vector(ififo_data_i);
 
+    -- Read from OFIFO, latch the first response and count the available ones
+    if ((spi_state_r = SS_C2 and spi_command_r(3 downto 1) = "100") or
+        (spi_state_r = SS_IFIFO_C5 and spi_command_r(3 downto 1) = "101")) then
+      if (ofifo_rdempty = '0' or spi_dvalid_r = '1') then
+        ofifo_rdreq <= not spi_dvalid_r;
+        spi_dvalid_x <= '1';
+      else
+        spi_dvalid_x <= '0';
+        spi_irq_reset_i <= '1';
+      end if;
+      -- Count includes a response held over from the previous transaction
+      if (spi_dvalid_r = '1' and ofifo_rdusedw = x"ff") then
+        spi_count_x <= x"ff";
+      else
+        spi_count_x <= std_logic_vector(unsigned(ofifo_rdusedw) + ("0000000" & spi_dvalid_r));
+      end if;
+    end if;
+
     case (spi_state_r) is
     when SS_C0 =>
       spi_command_x <= spi_data;
@@ -427,16 +568,16 @@ begin
       spi_address_x(7 downto 4) <= spi_data;
     when SS_C2 =>
       spi_address_x(3 downto 0) <= spi_data;
-      if( spi_command_r(3) = '1' ) then
+      if (spi_command_r(3) = '1' and spi_command_r(1) = '0') then
         -- Read from OFIFO
-        if (ofifo_rdempty = '0' or spi_dvalid_r = '1') then
-          ofifo_rdreq <= not spi_dvalid_r;
-          spi_dvalid_x <= '1';
+        if (spi_command_r(0) = '1') then
+          spi_state_x <= SS_COUNT_C3;
         else
-          spi_dvalid_x <= '0';
-          spi_irq_reset_i <= '1';
+          spi_state_x <= SS_OFIFO_C3;
         end if;
-        spi_state_x <= SS_OFIFO_C3;
+      elsif (spi_command_r(3) = '0' and spi_command_r(2) = '1') then
+        -- Bulk properties
+        spi_state_x <= SS_BULK;
       else
         -- Write to IFIFO
         spi_state_x <= SS_IFIFO_C3;
@@ -451,10 +592,39 @@ begin
       spi_state_x <= SS_IFIFO_C5;
     when SS_IFIFO_C5 =>
       ififo_wrreq <= '1';
-      spi_state_x <= SS_IFIFO_C6;
+      if (spi_command_r(3) = '1') then
+        -- Reply and read, continue with the read from OFIFO
+        if (spi_command_r(0) = '1') then
+          spi_state_x <= SS_COUNT_C3;
+        else
+          spi_state_x <= SS_OFIFO_C3;
+        end if;
+      else
+        spi_state_x <= SS_IFIFO_C6;
+      end if;
     when SS_IFIFO_C6 =>
       spi_state_x <= SS_IFIFO_C6;
 
+    -- Bulk properties, one port per clock. Port 0xff (global enable) is
+    -- left alone.
+    when SS_BULK =>
+      ififo_data_i.command <= t_incmd_set_properties;
+      ififo_data_i.data <= "0000" & spi_data;
+      if (spi_address_r /= x"ff") then
+        ififo_wrreq <= '1';
+        spi_address_x <= std_logic_vector(unsigned(spi_address_r) + 1);
+      end if;
+
+    -- Batched read, response count header
+    when SS_COUNT_C3 =>
+      spi_oe_x <= '1';
+      spi_out_x <= spi_count_r(7 downto 4);
+      spi_state_x <= SS_COUNT_C4;
+    when SS_COUNT_C4 =>
+      spi_oe_x <= '1';
+      spi_out_x <= spi_count_r(3 downto 0);
+      spi_state_x <= SS_OFIFO_C3;
+
     -- Read from OFIFO
     -- Note: Bytes are little endian, bits are msb-first
     when SS_OFIFO_C3 => -- bits 7..4
@@ -506,6 +676,7 @@ begin
       spi_address_r <= spi_address_x;
       spi_data_r <= spi_data_x;
       spi_dvalid_r <= spi_dvalid_x;
+      spi_count_r <= spi_count_x;
     end if;
   end process;
 
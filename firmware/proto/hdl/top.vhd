@@ -178,6 +178,9 @@ architecture rtl of top is
 
   -- Slot IRQ
   signal slot_irq_i                 : std_logic;
+  signal adpcm_credit_i             : std_logic_vector(7 downto 0);
+  signal adpcm_credit_valid_i       : std_logic;
+  signal adpcm_credit_clear_i       : std_logic;
   
   -- Misc card
   signal our_slot_i                 : std_logic_vector(1 downto 0);
@@ -569,6 +572,11 @@ begin
     -- Audio data
     audio_data         => audio_sample_i,
 
+    -- ADPCM FIFO credits
+    adpcm_credit       => adpcm_credit_i,
+    adpcm_credit_valid => adpcm_credit_valid_i,
+    adpcm_credit_clear => adpcm_credit_clear_i,
+
     -- io slave port   =>
     ios_read           => iom_esp_read_i,
     ios_write          => iom_esp_write_i,
@@ -594,6 +602,9 @@ begin
     clock                      => sysclk,
     slot_reset                 => slot_reset_i,
     slot_irq                   => open, --slot_irq_i,
+    adpcm_credit               => adpcm_credit_i,
+    adpcm_credit_valid         => adpcm_credit_valid_i,
+    adpcm_credit_clear         => adpcm_credit_clear_i,
     -- IO bus
     ios_read                   => iom_audiodev_read_i,
     ios_write                  => iom_audiodev_write_i,